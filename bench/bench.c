@@ -0,0 +1,482 @@
+// headless throughput benchmark: runs SimStep at a fixed dt and seed, no window, CSV on stdout;
+// --replay runs a saved snapshot or recording instead of the synthetic scenes,
+// --check-kernels compares the vector integrate kernels against the scalar ones and exits, and
+// --check-sleep checks that resting particles go to sleep and stay in contact, and exits, and
+// --check-threads checks that a seed ends in the same state at every thread count, and exits
+#include "integrate.h"
+#include "pool.h"
+#include "sim.h"
+#include "simthread.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// the sim thread's step; build with -DSIM_HZ=N to time coarser ones
+#define BENCH_DT SIM_DT
+
+#define MAX_COUNTS 32
+
+// --check-kernels: particles and steps per gravity / brownian combination, and how far the
+// vector kernels may be from the scalar ones, relative to the value and never less than absolute
+#define CHECK_PARTICLES 10007
+#define CHECK_STEPS 200
+#define CHECK_TOLERANCE 1e-4f
+
+// --check-sleep: particles dropped in a band PILE_DEPTH deep at the bottom of the world, steps
+// with extra damping to bring the pile to rest and then without, and the share of it that
+// has to be asleep at the end. The same number laid on the floor, with a thruster held for
+// EMIT_STEPS, and that share still asleep and within FLOOR_GAP of the floor.
+#define PILE_PARTICLES 1500
+#define PILE_DEPTH 100
+#define PILE_DAMPING .99f
+#define SETTLE_STEPS 6000
+#define REST_STEPS 2000
+#define PILE_ASLEEP .9
+#define EMIT_STEPS 2000
+#define FLOOR_GAP .5f
+
+// --check-threads: particles and steps with everything on, run at each of the worker counts,
+// over THREAD_EMITTERS unless --emitters says otherwise so that the pools' ends fall mid-block;
+// the state must come out bit for bit the same, so build it with the Release flags
+#define THREAD_EMITTERS 3
+#define THREAD_PARTICLES 20011
+#define THREAD_STEPS 300
+static const size_t thread_counts[] = {1, 2, 3, 7};
+
+static size_t counts[MAX_COUNTS] = {1000, 4500, 20000, 100000};
+static size_t ncounts = 4;
+static Vector2 start_pos[MAX_EMITTERS];
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// reset the world and scatter n live particles across it, split over the emitters
+static void Setup(const unsigned seed, const size_t n) {
+    SimSeed(seed);
+    frames = 0;
+    for (size_t k = 0; k < num_emitters; k++) {
+        Emitter *em = &emitters[k];
+        em->pos = start_pos[k];
+        em->velocity = (Vector2){-80.f, -80.f};
+        em->size = EMITTER_SIZE;
+        const size_t count = n * (k + 1) / num_emitters - n * k / num_emitters;
+        ResetParticles(em);
+        Particles *p = &em->particles;
+        for (size_t i = 0; i < count; i++) {
+            p->x[i] = GetRandomValue(1, (int) world_width - PARTICLE_SIZE);
+            p->y[i] = GetRandomValue(1, (int) world_height - PARTICLE_SIZE);
+            p->vx[i] = GetRandomValue(-64, 64) / 8.f;
+            p->vy[i] = GetRandomValue(-128, 128) / 8.f;
+            p->size[i] = PARTICLE_SIZE;
+            p->age[i] = 0;
+            p->still[i] = 0;
+        }
+        em->count = count;
+    }
+    // drawn from the frame's stream, and they push out what they come down on
+    generateRandomBarriers();
+}
+
+static size_t LiveParticles(void) {
+    size_t n = 0;
+    for (size_t k = 0; k < num_emitters; k++) {
+        n += emitters[k].count;
+    }
+    return n;
+}
+
+static float Uniform(const float lo, const float hi) {
+    return lo + (hi - lo) * GetRandomValue(0, 1 << 20) / (float) (1 << 20);
+}
+
+// worst difference between a and b over n values, relative to their size once that is past 1
+static float WorstError(const float *a, const float *b, const size_t n) {
+    float worst = 0;
+    for (size_t i = 0; i < n; i++) {
+        worst = fmaxf(worst, fabsf(a[i] - b[i]) / fmaxf(1.f, fabsf(b[i])));
+    }
+    return worst;
+}
+
+// one step of the selected kernels and of the scalar ones from the same state, compared every
+// step and then carried on from the scalar result so the runs don't drift apart; false if any
+// combination is out of tolerance
+static bool CheckKernels(const unsigned seed) {
+    const size_t n = CHECK_PARTICLES;
+    enum { X, Y, VX, VY, SIZE, JX, JY, ARRAYS };
+    float *ref = malloc(ARRAYS * n * sizeof(float)), *vec = malloc(ARRAYS * n * sizeof(float));
+    if (!ref || !vec) {
+        free(ref);
+        free(vec);
+        return false;
+    }
+    IntegrateInit();
+    const char *name = IntegrateBackend();
+    bool ok = true;
+    SetRandomSeed(seed);
+    for (int flags = 0; flags < 4; flags++) {
+        const IntegrateParams params = {.dt = BENCH_DT * TIMESCALE,
+                                        .width = SCREEN_WIDTH,
+                                        .height = SCREEN_HEIGHT,
+                                        .friction_scale = 1.f / (MAX_ESIZE * 2),
+                                        .gravity = flags & 1 ? 5.f * BENCH_DT * TIMESCALE : 0,
+                                        .brown_factor = flags & 2 ? .5f : 0,
+                                        .drag = .99995f};
+        for (size_t i = 0; i < n; i++) {
+            // a few right at the walls, where the clamps and the friction branches are
+            const float size = Uniform(1, MAX_ESIZE);
+            ref[SIZE * n + i] = size;
+            ref[X * n + i] = i % 16 == 0 ? 1.f : Uniform(1, SCREEN_WIDTH - size);
+            ref[Y * n + i] = i % 16 == 1 ? SCREEN_HEIGHT - size : Uniform(1, SCREEN_HEIGHT - size);
+            ref[VX * n + i] = Uniform(-200, 200);
+            ref[VY * n + i] = Uniform(-200, 200);
+        }
+        float worst = 0;
+        for (int s = 0; s < CHECK_STEPS; s++) {
+            for (size_t i = 0; i < n; i++) {
+                ref[JX * n + i] = Uniform(-1, 1);
+                ref[JY * n + i] = Uniform(-1, 1);
+            }
+            memcpy(vec, ref, ARRAYS * n * sizeof(float));
+            IntegrateInit();
+            IntegrateMove(&params, vec + X * n, vec + Y * n, vec + VX * n, vec + VY * n,
+                          vec + SIZE * n, n);
+            IntegrateForces(&params, vec + VX * n, vec + VY * n, vec + JX * n, vec + JY * n, n);
+            IntegrateUseScalar();
+            IntegrateMove(&params, ref + X * n, ref + Y * n, ref + VX * n, ref + VY * n,
+                          ref + SIZE * n, n);
+            IntegrateForces(&params, ref + VX * n, ref + VY * n, ref + JX * n, ref + JY * n, n);
+            worst = fmaxf(worst, WorstError(vec, ref, 4 * n));
+        }
+        const bool pass = worst <= CHECK_TOLERANCE;
+        fprintf(stderr,
+                "%s vs scalar, gravity %d brownian %d: worst error %g %s\n",
+                name,
+                flags & 1,
+                !!(flags & 2),
+                worst,
+                pass ? "ok" : "FAILED");
+        ok &= pass;
+    }
+    IntegrateInit();
+    free(ref);
+    free(vec);
+    return ok;
+}
+
+static size_t Asleep(void) {
+    size_t n = 0;
+    for (size_t k = 0; k < num_emitters; k++) {
+        for (size_t i = 0; i < emitters[k].count; i++) {
+            n += asleep(&emitters[k].particles, i);
+        }
+    }
+    return n;
+}
+
+// a pile under gravity and repulsion should sleep once it is at rest, those on the floor or
+// under others too. Repulsion hardly loses energy, so the pile is damped into rest first;
+// after that the sleepers must stay asleep by themselves.
+static bool CheckPileSleeps(const unsigned seed) {
+    b_gravity = b_repulsion = b_nwtn3rd = true;
+    b_brownian = false;
+    Setup(seed, PILE_PARTICLES);
+    SimApply(&(SimCommand){CMD_STOP_ALL});
+    for (size_t k = 0; k < num_emitters; k++) {
+        Particles *p = &emitters[k].particles;
+        for (size_t i = 0; i < emitters[k].count; i++) {
+            p->y[i] = world_height - PARTICLE_SIZE - Uniform(0, PILE_DEPTH);
+            p->vx[i] = p->vy[i] = 0;
+        }
+    }
+    for (size_t s = 0; s < SETTLE_STEPS + REST_STEPS; s++) {
+        SimStep(BENCH_DT);
+        for (size_t k = 0; s < SETTLE_STEPS && k < num_emitters; k++) {
+            Particles *p = &emitters[k].particles;
+            for (size_t i = 0; i < emitters[k].count; i++) {
+                p->vx[i] *= PILE_DAMPING;
+                p->vy[i] *= PILE_DAMPING;
+            }
+        }
+    }
+    const size_t n = LiveParticles(), sleeping = Asleep();
+    const bool pass = sleeping >= PILE_ASLEEP * n;
+    fprintf(stderr, "pile: %zu of %zu asleep %s\n", sleeping, n, pass ? "ok" : "FAILED");
+    return pass;
+}
+
+// particles asleep on the floor under gravity alone, then steps with a thruster held, which
+// age and shrink them: those the exhaust didn't stir up must still lie on the floor
+static bool CheckShrinkingSleepers(const unsigned seed) {
+    b_gravity = b_nwtn3rd = true;
+    b_brownian = b_repulsion = false;
+    Setup(seed, PILE_PARTICLES);
+    SimApply(&(SimCommand){CMD_STOP_ALL});
+    // emission only appends, so these keep their indices
+    const Particles *p = &emitters[0].particles;
+    const size_t count = emitters[0].count;
+    for (size_t i = 0; i < count; i++) {
+        p->y[i] = world_height - PARTICLE_SIZE;
+        p->vx[i] = p->vy[i] = 0;
+    }
+    for (size_t s = 0; s < REST_STEPS; s++) {
+        SimStep(BENCH_DT);
+    }
+    SimApply(&(SimCommand){CMD_THRUST, 1u << UP});
+    for (size_t s = 0; s < EMIT_STEPS; s++) {
+        SimStep(BENCH_DT);
+    }
+    SimApply(&(SimCommand){CMD_THRUST, 0});
+    size_t sleeping = 0, lifted = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (asleep(p, i)) {
+            sleeping++;
+            lifted += world_height - (p->y[i] + p->size[i]) >= FLOOR_GAP;
+        }
+    }
+    const bool pass = sleeping >= PILE_ASLEEP * count && lifted == 0;
+    fprintf(stderr,
+            "floor after %d emitting steps: %zu of %zu asleep, %zu of them off the floor %s\n",
+            EMIT_STEPS,
+            sleeping,
+            count,
+            lifted,
+            pass ? "ok" : "FAILED");
+    return pass;
+}
+
+static bool CheckSleep(const unsigned seed) {
+    // both, even when the first fails
+    const bool pile = CheckPileSleeps(seed);
+    return CheckShrinkingSleepers(seed) && pile;
+}
+
+static uint64_t Fnv(uint64_t h, const void *data, const size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        h = (h ^ ((const unsigned char *) data)[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// FNV-1a over the emitters and every live particle
+static uint64_t HashState(void) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Emitter *em = &emitters[k];
+        const Particles *p = &em->particles;
+        h = Fnv(h, &em->pos, sizeof(em->pos));
+        h = Fnv(h, &em->velocity, sizeof(em->velocity));
+        h = Fnv(h, &em->count, sizeof(em->count));
+        h = Fnv(h, p->x, em->count * sizeof(float));
+        h = Fnv(h, p->y, em->count * sizeof(float));
+        h = Fnv(h, p->vx, em->count * sizeof(float));
+        h = Fnv(h, p->vy, em->count * sizeof(float));
+        h = Fnv(h, p->size, em->count * sizeof(float));
+    }
+    return h;
+}
+
+// the same seeded run on each worker count in turn, hashed at the end, with either kind of
+// repulsion; false unless the hashes agree
+static bool CheckThreads(const unsigned seed) {
+    b_gravity = b_brownian = b_nwtn3rd = b_repulsion = true;
+    bool ok = true;
+    for (int tree = 0; tree < 2; tree++) {
+        b_barnes_hut = tree;
+        uint64_t first = 0;
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(*thread_counts); t++) {
+            PoolShutdown();
+            PoolInit(thread_counts[t]);
+            Setup(seed, THREAD_PARTICLES);
+            for (size_t s = 0; s < THREAD_STEPS; s++) {
+                SimStep(BENCH_DT);
+            }
+            const uint64_t h = HashState();
+            first = t == 0 ? h : first;
+            ok &= h == first;
+            fprintf(stderr,
+                    "%zu threads, %zu emitters, %s repulsion: %016llx %s\n",
+                    PoolSize(),
+                    num_emitters,
+                    tree ? "quadtree" : "grid",
+                    (unsigned long long) h,
+                    h == first ? "ok" : "FAILED");
+        }
+    }
+    return ok;
+}
+
+static void Usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--steps N] [--seed N] [--threads N] [--emitters N] [--counts N,N,...] "
+            "[--barriers N] [--world WxH] [--hugepages] [--barnes-hut] [--replay FILE] "
+            "[--check-kernels] [--check-sleep] [--check-threads]\n",
+            argv0);
+    exit(1);
+}
+
+// time steps steps of dt from the current state and print them as one CSV row; a replay
+// feeds in its recorded commands as their frames come up
+static void Run(const size_t steps, const float dt, const bool replay) {
+    const size_t particles = LiveParticles();
+    const bool gravity = b_gravity, brownian = b_brownian, nwtn3rd = b_nwtn3rd,
+               repulsion = b_repulsion;
+    // count the live pool every step, emission grows it while nwtn3rd is off
+    double particle_steps = 0;
+    const double start = Now();
+    for (size_t s = 0; s < steps; s++) {
+        if (replay) {
+            ReplayTick();
+        }
+        SimStep(dt);
+        particle_steps += LiveParticles();
+    }
+    const double seconds = Now() - start;
+    printf("%zu,%zu,%d,%d,%d,%d,%zu,%.6f,%.1f,%.2f\n",
+           particles,
+           num_emitters,
+           gravity,
+           brownian,
+           nwtn3rd,
+           repulsion,
+           steps,
+           seconds,
+           steps / seconds,
+           seconds * 1e9 / particle_steps);
+}
+
+int main(int argc, char **argv) {
+    size_t steps = 1000;
+    unsigned seed = 1;
+    bool check = false, check_sleep = false, check_threads = false;
+    // emitters 0 until --emitters sets them
+    SimConfig config = {0, 0, 0, NUM_BARRIERS, false, NULL, NULL, 0, 0, false};
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--hugepages")) {
+            config.hugepages = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--barnes-hut")) {
+            b_barnes_hut = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--check-kernels")) {
+            check = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--check-sleep")) {
+            check_sleep = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--check-threads")) {
+            check_threads = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            Usage(argv[0]);
+        }
+        if (!strcmp(argv[i], "--steps")) {
+            steps = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads")) {
+            config.threads = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--emitters")) {
+            const size_t n = strtoul(argv[++i], NULL, 10);
+            config.emitters = min(max(n, 1), MAX_EMITTERS);
+        } else if (!strcmp(argv[i], "--barriers")) {
+            config.barriers = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--world")) {
+            if (sscanf(argv[++i], "%fx%f", &config.world_width, &config.world_height) != 2) {
+                Usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "--replay")) {
+            config.replay = argv[++i];
+        } else if (!strcmp(argv[i], "--counts")) {
+            char *s = argv[++i];
+            for (ncounts = 0; ncounts < MAX_COUNTS && *s; ncounts++) {
+                counts[ncounts] = strtoul(s, &s, 10);
+                if (*s == ',') {
+                    s++;
+                }
+            }
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (check) {
+        return CheckKernels(seed) ? 0 : 1;
+    }
+    if (check_sleep) {
+        // room for what the thruster emits
+        counts[0] = PILE_PARTICLES + EMIT_STEPS;
+        ncounts = 1;
+    }
+    if (check_threads) {
+        counts[0] = THREAD_PARTICLES;
+        ncounts = 1;
+    }
+    if (config.emitters == 0) {
+        config.emitters = check_threads ? THREAD_EMITTERS : 1;
+    }
+    for (size_t c = 0; c < ncounts; c++) {
+        config.capacity = max(config.capacity, (counts[c] + config.emitters - 1) / config.emitters);
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    if (ncounts == 0 || !SimInit(&config)) {
+        return 1;
+    }
+    if (config.replay && !ReplayStart(config.replay)) {
+        SimShutdown();
+        return 1;
+    }
+    for (size_t k = 0; k < num_emitters; k++) {
+        start_pos[k] = emitters[k].pos;
+    }
+    if (check_sleep) {
+        const bool pass = CheckSleep(seed);
+        SimShutdown();
+        return pass ? 0 : 1;
+    }
+    if (check_threads) {
+        const bool pass = CheckThreads(seed);
+        SimShutdown();
+        return pass ? 0 : 1;
+    }
+    fprintf(stderr,
+            "threads: %zu, emitters: %zu, world: %.0fx%.0f, integrator: %s, repulsion: %s\n",
+            PoolSize(),
+            num_emitters,
+            world_width,
+            world_height,
+            IntegrateBackend(),
+            b_barnes_hut ? "quadtree" : "grid");
+
+    printf("particles,emitters,gravity,brownian,nwtn3rd,repulsion,steps,seconds,steps_per_sec,"
+           "ns_per_particle_step\n");
+    if (config.replay) {
+        // at the rate it was recorded at, or the run diverges from the recording
+        Run(steps, SIM_DT, true);
+        ReplayStop();
+        SimShutdown();
+        return 0;
+    }
+    for (size_t c = 0; c < ncounts; c++) {
+        for (unsigned flags = 0; flags < 16; flags++) {
+            b_gravity = flags & 1;
+            b_brownian = flags & 2;
+            b_nwtn3rd = flags & 4;
+            b_repulsion = flags & 8;
+            Setup(seed, counts[c]);
+            Run(steps, BENCH_DT, false);
+        }
+    }
+    SimShutdown();
+    return 0;
+}
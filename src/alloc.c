@@ -0,0 +1,39 @@
+#include "alloc.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+void *PageAlloc(size_t bytes, bool huge) {
+#ifdef _WIN32
+    // large pages need SeLockMemoryPrivilege, so plain pages it is
+    (void) huge;
+    return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#else
+    (void) huge;
+#endif
+    return ptr;
+#endif
+}
+
+void PageFree(void *ptr, size_t bytes) {
+    if (!ptr) {
+        return;
+    }
+#ifdef _WIN32
+    (void) bytes;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, bytes);
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// page-aligned, zeroed allocation straight from the os; huge asks for transparent huge pages
+void *PageAlloc(size_t bytes, bool huge);
+void PageFree(void *ptr, size_t bytes);
+
+#endif
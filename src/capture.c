@@ -0,0 +1,383 @@
+#include "capture.h"
+#include "clock.h"
+#include "raylib.h"
+#include "rlgl.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(GRAPHICS_API_OPENGL_33) || defined(GRAPHICS_API_OPENGL_43)
+// the GL entry points raylib has loaded; rlgl has no pixel pack buffers or fences of its own
+#include "external/glad.h"
+#define CAPTURE_PBO
+#endif
+
+#define CAPTURE_FPS 60
+// frames read back and waiting on the GPU
+#define CAPTURE_RING 3
+// frames collected and waiting on a writer
+#define CAPTURE_QUEUE 8
+#define CAPTURE_WRITERS 4
+
+#define min(a, b) ((a) > (b) ? (b) : (a))
+
+// a queue slot is filled by the render thread while FILLING, then goes to one writer
+typedef enum { SLOT_FREE, SLOT_FILLING, SLOT_READY, SLOT_WRITING } SlotState;
+
+static struct {
+    uint8_t *pixels;
+    size_t index; // frame number within the capture
+    SlotState state;
+} queue[CAPTURE_QUEUE];
+static uint8_t *queue_block;
+
+// guards the queue only, never held across encoding or I/O
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static pthread_t writers[CAPTURE_WRITERS];
+static size_t nwriters;
+static bool stopping;
+
+// the y4m stream takes frames in order: a writer holding a later one waits for its turn
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_turn = PTHREAD_COND_INITIALIZER;
+static FILE *stream;
+static size_t next_write;
+
+static CaptureFormat format;
+static char name[256];
+static int width, height;
+static bool bottom_up; // rows in the order glReadPixels leaves them
+static bool capturing;
+static double next_due;
+static size_t queued; // frames handed to the writers so far
+static atomic_size_t dropped, written, failed;
+
+#ifdef CAPTURE_PBO
+static bool use_pbo;
+static struct {
+    GLuint pbo;
+    GLsync fence;
+} ring[CAPTURE_RING];
+// frames read back and collected; ring[i % CAPTURE_RING] is in flight for tail <= i < head
+static size_t ring_head, ring_tail;
+#endif
+
+static const uint8_t *Row(const uint8_t *pixels, const int y) {
+    return pixels + (size_t) (bottom_up ? height - 1 - y : y) * width * 4;
+}
+
+// full-range BT.601, each chroma sample from the mean of its 2x2 block
+static void ToYuv420(const uint8_t *rgba, uint8_t *yuv) {
+    const size_t w = width, cw = width / 2;
+    uint8_t *py = yuv, *pu = yuv + w * height, *pv = pu + cw * (height / 2);
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t *rows[2] = {Row(rgba, y), Row(rgba, y + 1)};
+        for (size_t x = 0; x < w; x += 2) {
+            int r = 0, g = 0, b = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (size_t dx = 0; dx < 2; dx++) {
+                    const uint8_t *p = rows[dy] + 4 * (x + dx);
+                    py[(y + dy) * w + x + dx] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            // sums of four: the offset is 128 and a half at 4 * 256 to the unit
+            const size_t c = (y / 2) * cw + x / 2;
+            pu[c] = min((-43 * r - 85 * g + 128 * b + 131584) >> 10, 255);
+            pv[c] = min((128 * r - 107 * g - 21 * b + 131584) >> 10, 255);
+        }
+    }
+}
+
+static bool WriteY4m(const size_t index, const uint8_t *yuv) {
+    const size_t bytes = (size_t) width * height * 3 / 2;
+    pthread_mutex_lock(&stream_lock);
+    while (next_write != index) {
+        pthread_cond_wait(&stream_turn, &stream_lock);
+    }
+    const bool ok = fputs("FRAME\n", stream) >= 0 && fwrite(yuv, 1, bytes, stream) == bytes;
+    next_write++;
+    pthread_cond_broadcast(&stream_turn);
+    pthread_mutex_unlock(&stream_lock);
+    return ok;
+}
+
+static bool WritePng(const size_t index, const uint8_t *rgba) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s-%06zu.png", name, index);
+    return ExportImage((Image){.data = (void *) rgba,
+                               .width = width,
+                               .height = height,
+                               .mipmaps = 1,
+                               .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8},
+                       path);
+}
+
+// convert or flip a frame into the writer's own buffer, free its slot, then encode and write it
+static void *WriterMain(void *arg) {
+    uint8_t *scratch = arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        int s = -1;
+        for (int i = 0; i < CAPTURE_QUEUE; i++) {
+            if (queue[i].state == SLOT_READY && (s < 0 || queue[i].index < queue[s].index)) {
+                s = i;
+            }
+        }
+        if (s < 0) {
+            if (stopping) {
+                break;
+            }
+            pthread_cond_wait(&ready, &lock);
+            continue;
+        }
+        queue[s].state = SLOT_WRITING;
+        const size_t index = queue[s].index;
+        pthread_mutex_unlock(&lock);
+
+        if (format == CAPTURE_Y4M) {
+            ToYuv420(queue[s].pixels, scratch);
+        } else {
+            for (int y = 0; y < height; y++) {
+                uint8_t *row = scratch + (size_t) y * width * 4;
+                memcpy(row, Row(queue[s].pixels, y), (size_t) width * 4);
+                for (int x = 0; x < width; x++) {
+                    row[4 * x + 3] = 0xFF;
+                }
+            }
+        }
+        pthread_mutex_lock(&lock);
+        queue[s].state = SLOT_FREE;
+        pthread_mutex_unlock(&lock);
+
+        const bool ok = format == CAPTURE_Y4M ? WriteY4m(index, scratch) : WritePng(index, scratch);
+        atomic_fetch_add(ok ? &written : &failed, 1);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    free(scratch);
+    return NULL;
+}
+
+// copy a frame into a free slot for the writers, or drop it if they are all taken
+static void Enqueue(const uint8_t *pixels) {
+    pthread_mutex_lock(&lock);
+    int s = 0;
+    while (s < CAPTURE_QUEUE && queue[s].state != SLOT_FREE) {
+        s++;
+    }
+    if (s == CAPTURE_QUEUE) {
+        pthread_mutex_unlock(&lock);
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    queue[s].state = SLOT_FILLING;
+    pthread_mutex_unlock(&lock);
+    memcpy(queue[s].pixels, pixels, (size_t) width * height * 4);
+    pthread_mutex_lock(&lock);
+    queue[s].index = queued++;
+    queue[s].state = SLOT_READY;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+}
+
+#ifdef CAPTURE_PBO
+// map the read-backs the GPU has finished, oldest first; with wait, all of them
+static void Collect(const bool wait) {
+    for (; ring_tail != ring_head; ring_tail++) {
+        GLsync *fence = &ring[ring_tail % CAPTURE_RING].fence;
+        const GLenum status = glClientWaitSync(*fence,
+                                               wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                               wait ? 1000000000 : 0);
+        if (!wait && status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return;
+        }
+        glDeleteSync(*fence);
+        *fence = NULL;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ring[ring_tail % CAPTURE_RING].pbo);
+        const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER,
+                                              0,
+                                              (GLsizeiptr) width * height * 4,
+                                              GL_MAP_READ_BIT);
+        if (pixels) {
+            Enqueue(pixels);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        } else {
+            atomic_fetch_add(&dropped, 1);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+// start reading the back buffer into the next free pixel buffer
+static void Issue(void) {
+    if (ring_head - ring_tail == CAPTURE_RING) {
+        // the GPU hasn't finished any of them
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    const size_t i = ring_head++ % CAPTURE_RING;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring[i].pbo);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ring[i].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+#endif
+
+bool CaptureStart(const char *base, const CaptureFormat fmt, const int w, const int h) {
+    if (capturing) {
+        return true;
+    }
+    format = fmt;
+    snprintf(name, sizeof(name), "%s", base);
+    // 4:2:0 needs even sides
+    width = w & ~1;
+    height = h & ~1;
+    const size_t bytes = (size_t) width * height * 4;
+    if (width <= 0 || height <= 0 || !(queue_block = malloc(CAPTURE_QUEUE * bytes))) {
+        fprintf(stderr, "could not start capture '%s'\n", name);
+        return false;
+    }
+    for (int i = 0; i < CAPTURE_QUEUE; i++) {
+        queue[i].pixels = queue_block + i * bytes;
+        queue[i].state = SLOT_FREE;
+    }
+    if (format == CAPTURE_Y4M) {
+        char path[300];
+        snprintf(path, sizeof(path), "%s.y4m", name);
+        if (!(stream = fopen(path, "wb"))) {
+            fprintf(stderr, "could not open capture '%s'\n", path);
+            free(queue_block);
+            return false;
+        }
+        fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, CAPTURE_FPS);
+    }
+    queued = next_write = 0;
+    atomic_store(&dropped, 0);
+    atomic_store(&written, 0);
+    atomic_store(&failed, 0);
+    stopping = false;
+    for (nwriters = 0; nwriters < CAPTURE_WRITERS; nwriters++) {
+        uint8_t *scratch = malloc(format == CAPTURE_Y4M ? bytes * 3 / 8 : bytes);
+        if (!scratch || pthread_create(&writers[nwriters], NULL, WriterMain, scratch) != 0) {
+            free(scratch);
+            break;
+        }
+    }
+    if (nwriters == 0) {
+        fprintf(stderr, "could not start capture writers\n");
+        if (stream) {
+            fclose(stream);
+            stream = NULL;
+        }
+        free(queue_block);
+        return false;
+    }
+
+    bottom_up = false;
+#ifdef CAPTURE_PBO
+    use_pbo = rlGetVersion() == RL_OPENGL_33 || rlGetVersion() == RL_OPENGL_43;
+    if (use_pbo) {
+        for (int i = 0; i < CAPTURE_RING; i++) {
+            glGenBuffers(1, &ring[i].pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, ring[i].pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) bytes, NULL, GL_STREAM_READ);
+            ring[i].fence = NULL;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        ring_head = ring_tail = 0;
+        bottom_up = true;
+    }
+#endif
+    next_due = ClockNow();
+    capturing = true;
+    return true;
+}
+
+void CaptureFrame(void) {
+    if (!capturing) {
+        return;
+    }
+#ifdef CAPTURE_PBO
+    if (use_pbo) {
+        Collect(false);
+    }
+#endif
+    const double now = ClockNow();
+    if (now < next_due) {
+        return;
+    }
+    // a slow frame doesn't owe the stream the ones it missed
+    next_due = next_due + 1. / CAPTURE_FPS > now ? next_due + 1. / CAPTURE_FPS
+                                                 : now + 1. / CAPTURE_FPS;
+    // everything raylib has batched has to be in the back buffer first
+    rlDrawRenderBatchActive();
+#ifdef CAPTURE_PBO
+    if (use_pbo) {
+        Issue();
+        return;
+    }
+#endif
+    // no pixel buffers: a synchronous read, which stalls on the GPU but still not on the disk
+    unsigned char *pixels = rlReadScreenPixels(width, height);
+    if (pixels) {
+        Enqueue(pixels);
+        MemFree(pixels);
+    } else {
+        atomic_fetch_add(&dropped, 1);
+    }
+}
+
+void CaptureStop(void) {
+    if (!capturing) {
+        return;
+    }
+    capturing = false;
+#ifdef CAPTURE_PBO
+    if (use_pbo) {
+        Collect(true);
+        for (int i = 0; i < CAPTURE_RING; i++) {
+            glDeleteBuffers(1, &ring[i].pbo);
+        }
+    }
+#endif
+    // the one place the render thread waits for the writers, to finish what is queued
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&ready);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < nwriters; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    nwriters = 0;
+    if (stream && fclose(stream) != 0) {
+        atomic_fetch_add(&failed, 1);
+    }
+    stream = NULL;
+    free(queue_block);
+    queue_block = NULL;
+    fprintf(stderr,
+            "capture '%s': %zu frames written, %zu dropped\n",
+            name,
+            atomic_load(&written),
+            atomic_load(&dropped));
+    if (atomic_load(&failed)) {
+        fprintf(stderr,
+                "capture '%s': %zu frames could not be written\n",
+                name,
+                atomic_load(&failed));
+    }
+}
+
+bool Capturing(void) {
+    return capturing;
+}
+
+size_t CaptureDropped(void) {
+    return atomic_load(&dropped);
+}
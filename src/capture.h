@@ -0,0 +1,27 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Frame capture of the window for offline review. Each frame is read back into a ring of pixel
+// buffers without waiting for the GPU and collected a few frames later, then copied into a
+// bounded queue that writer threads drain to disk. When the ring or the queue is full the
+// frame is dropped and counted; the render thread never waits on the encoder or the disk.
+
+typedef enum {
+    CAPTURE_Y4M, // one YUV4MPEG2 4:2:0 stream, name.y4m
+    CAPTURE_PNG, // numbered images, name-000000.png and on
+} CaptureFormat;
+
+// start capturing width x height pixels of the window at up to CAPTURE_FPS; call from the
+// thread that owns the GL context
+bool CaptureStart(const char *name, CaptureFormat format, int width, int height);
+// read back the frame just drawn; call after the last draw of the frame, before EndDrawing
+void CaptureFrame(void);
+// collect the frames still in flight, finish writing and report what was kept and dropped
+void CaptureStop(void);
+bool Capturing(void);
+size_t CaptureDropped(void);
+
+#endif
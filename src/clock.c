@@ -0,0 +1,35 @@
+#include "clock.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+double ClockNow(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (double) now.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+void ClockSleepUntil(double deadline) {
+    const double remaining = deadline - ClockNow();
+    if (remaining <= 0) {
+        return;
+    }
+#ifdef _WIN32
+    Sleep((DWORD) (remaining * 1000));
+#else
+    struct timespec ts = {(time_t) remaining, (long) ((remaining - (time_t) remaining) * 1e9)};
+    nanosleep(&ts, NULL);
+#endif
+}
@@ -0,0 +1,9 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// monotonic seconds, usable from any thread and without a window
+double ClockNow(void);
+// sleep until ClockNow() >= deadline, returns immediately if it already has passed
+void ClockSleepUntil(double deadline);
+
+#endif
@@ -0,0 +1,293 @@
+#include "integrate.h"
+#include <math.h>
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+#if defined(__GNUC__)
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+// the forces kernels are written once with the gravity / brownian toggles as parameters and
+// instantiated for every combination, so each variant is a branch-free loop
+#define FORCES_VARIANT(NAME, IMPL, GRAVITY, BROWNIAN, ...)                                     \
+    __VA_ARGS__ static void NAME(const IntegrateParams *params, float *vx, float *vy,         \
+                                 const float *jx, const float *jy, size_t n) {                \
+        IMPL(params, vx, vy, jx, jy, n, GRAVITY, BROWNIAN);                                    \
+    }
+#define FORCES_VARIANTS(IMPL, ...)                                                             \
+    FORCES_VARIANT(IMPL##Plain, IMPL, false, false, __VA_ARGS__)                               \
+    FORCES_VARIANT(IMPL##Brownian, IMPL, false, true, __VA_ARGS__)                             \
+    FORCES_VARIANT(IMPL##Gravity, IMPL, true, false, __VA_ARGS__)                              \
+    FORCES_VARIANT(IMPL##GravityBrownian, IMPL, true, true, __VA_ARGS__)
+// [gravity][brownian]
+#define FORCES_TABLE(IMPL) {{IMPL##Plain, IMPL##Brownian}, {IMPL##Gravity, IMPL##GravityBrownian}}
+
+// scalar kernels: the reference the vector paths must agree with, and their tail loops. At -O2
+// they agree bit for bit; -Ofast is free to contract and reassociate each path differently, so
+// only to within bench --check-kernels' tolerance
+
+static void MoveScalar(const IntegrateParams *params, float *x, float *y, float *vx, float *vy,
+                       const float *size, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const float s = fmaxf(size[i], 0), friction = 1 - s * params->friction_scale;
+        const float px = fminf(params->width - s, fmaxf(1.f, x[i] + vx[i] * params->dt)),
+                    py = fminf(params->height - s, fmaxf(1.f, y[i] + vy[i] * params->dt));
+        const float speed = sqrtf(vx[i] * vx[i] + vy[i] * vy[i]);
+        x[i] = px;
+        y[i] = py;
+        if (speed > .01f && (px == 1.f || px == params->width - s)) {
+            vx[i] *= -friction;
+            vy[i] *= friction;
+        }
+        if (speed > .01f && (py == 1.f || py == params->height - s)) {
+            vy[i] *= -friction;
+            vx[i] *= friction;
+        }
+    }
+}
+
+static KERNEL_INLINE void ForcesScalar(const IntegrateParams *params, float *vx, float *vy,
+                                       const float *jx, const float *jy, size_t n,
+                                       const bool gravity, const bool brownian) {
+    for (size_t i = 0; i < n; i++) {
+        float wx = vx[i], wy = gravity ? vy[i] + params->gravity : vy[i];
+        if (brownian) {
+            const float speed = sqrtf(wx * wx + wy * wy);
+            wx += jx[i] * params->brown_factor;
+            wy += jy[i] * params->brown_factor;
+            const float len = sqrtf(wx * wx + wy * wy), scale = len > 0 ? speed / len : 0;
+            wx *= scale;
+            wy *= scale;
+        }
+        vx[i] = wx * params->drag;
+        vy[i] = wy * params->drag;
+    }
+}
+
+FORCES_VARIANTS(ForcesScalar)
+
+#if defined(__SSE2__)
+
+// mask ? a : b
+#define SELECT_PS(mask, a, b) _mm_or_ps(_mm_and_ps((mask), (a)), _mm_andnot_ps((mask), (b)))
+
+static void MoveSSE2(const IntegrateParams *params, float *x, float *y, float *vx, float *vy,
+                     const float *size, size_t n) {
+    const __m128 dt = _mm_set1_ps(params->dt), one = _mm_set1_ps(1.f), zero = _mm_setzero_ps(),
+                 width = _mm_set1_ps(params->width), height = _mm_set1_ps(params->height),
+                 fscale = _mm_set1_ps(params->friction_scale), min_speed = _mm_set1_ps(.01f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 s = _mm_max_ps(_mm_loadu_ps(size + i), zero),
+                     friction = _mm_sub_ps(one, _mm_mul_ps(s, fscale)),
+                     nfriction = _mm_sub_ps(zero, friction);
+        const __m128 xmax = _mm_sub_ps(width, s), ymax = _mm_sub_ps(height, s);
+        __m128 u = _mm_loadu_ps(vx + i), v = _mm_loadu_ps(vy + i);
+        const __m128 px = _mm_min_ps(xmax, _mm_max_ps(one, _mm_add_ps(_mm_loadu_ps(x + i),
+                                                                      _mm_mul_ps(u, dt)))),
+                     py = _mm_min_ps(ymax, _mm_max_ps(one, _mm_add_ps(_mm_loadu_ps(y + i),
+                                                                      _mm_mul_ps(v, dt))));
+        const __m128 moving = _mm_cmpgt_ps(
+            _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v))), min_speed);
+        const __m128 hitx = _mm_and_ps(moving,
+                                       _mm_or_ps(_mm_cmpeq_ps(px, one), _mm_cmpeq_ps(px, xmax))),
+                     hity = _mm_and_ps(moving,
+                                       _mm_or_ps(_mm_cmpeq_ps(py, one), _mm_cmpeq_ps(py, ymax)));
+        u = _mm_mul_ps(u, SELECT_PS(hitx, nfriction, one));
+        v = _mm_mul_ps(v, SELECT_PS(hitx, friction, one));
+        v = _mm_mul_ps(v, SELECT_PS(hity, nfriction, one));
+        u = _mm_mul_ps(u, SELECT_PS(hity, friction, one));
+        _mm_storeu_ps(x + i, px);
+        _mm_storeu_ps(y + i, py);
+        _mm_storeu_ps(vx + i, u);
+        _mm_storeu_ps(vy + i, v);
+    }
+    MoveScalar(params, x + i, y + i, vx + i, vy + i, size + i, n - i);
+}
+
+static KERNEL_INLINE void ForcesSSE2(const IntegrateParams *params, float *vx, float *vy,
+                                     const float *jx, const float *jy, size_t n,
+                                     const bool gravity, const bool brownian) {
+    const __m128 g = _mm_set1_ps(params->gravity), drag = _mm_set1_ps(params->drag),
+                 bf = _mm_set1_ps(params->brown_factor), zero = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 u = _mm_loadu_ps(vx + i), v = _mm_loadu_ps(vy + i);
+        if (gravity) {
+            v = _mm_add_ps(v, g);
+        }
+        if (brownian) {
+            const __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)));
+            u = _mm_add_ps(u, _mm_mul_ps(_mm_loadu_ps(jx + i), bf));
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(jy + i), bf));
+            const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)));
+            const __m128 scale = _mm_and_ps(_mm_cmpgt_ps(len, zero), _mm_div_ps(speed, len));
+            u = _mm_mul_ps(u, scale);
+            v = _mm_mul_ps(v, scale);
+        }
+        _mm_storeu_ps(vx + i, _mm_mul_ps(u, drag));
+        _mm_storeu_ps(vy + i, _mm_mul_ps(v, drag));
+    }
+    ForcesScalar(params, vx + i, vy + i, jx + i, jy + i, n - i, gravity, brownian);
+}
+
+FORCES_VARIANTS(ForcesSSE2)
+
+#endif
+
+#if HAVE_AVX2_KERNELS
+
+#define AVX2_KERNEL __attribute__((target("avx2")))
+
+AVX2_KERNEL static inline __m256 Select256(__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+AVX2_KERNEL static void MoveAVX2(const IntegrateParams *params, float *x, float *y, float *vx,
+                                 float *vy, const float *size, size_t n) {
+    const __m256 dt = _mm256_set1_ps(params->dt), one = _mm256_set1_ps(1.f),
+                 zero = _mm256_setzero_ps(), width = _mm256_set1_ps(params->width),
+                 height = _mm256_set1_ps(params->height),
+                 fscale = _mm256_set1_ps(params->friction_scale),
+                 min_speed = _mm256_set1_ps(.01f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 s = _mm256_max_ps(_mm256_loadu_ps(size + i), zero),
+                     friction = _mm256_sub_ps(one, _mm256_mul_ps(s, fscale)),
+                     nfriction = _mm256_sub_ps(zero, friction);
+        const __m256 xmax = _mm256_sub_ps(width, s), ymax = _mm256_sub_ps(height, s);
+        __m256 u = _mm256_loadu_ps(vx + i), v = _mm256_loadu_ps(vy + i);
+        const __m256 px = _mm256_min_ps(
+                         xmax,
+                         _mm256_max_ps(one, _mm256_add_ps(_mm256_loadu_ps(x + i),
+                                                          _mm256_mul_ps(u, dt)))),
+                     py = _mm256_min_ps(
+                         ymax,
+                         _mm256_max_ps(one, _mm256_add_ps(_mm256_loadu_ps(y + i),
+                                                          _mm256_mul_ps(v, dt))));
+        const __m256 moving = _mm256_cmp_ps(
+            _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(v, v))),
+            min_speed,
+            _CMP_GT_OQ);
+        const __m256 hitx = _mm256_and_ps(moving,
+                                          _mm256_or_ps(_mm256_cmp_ps(px, one, _CMP_EQ_OQ),
+                                                       _mm256_cmp_ps(px, xmax, _CMP_EQ_OQ))),
+                     hity = _mm256_and_ps(moving,
+                                          _mm256_or_ps(_mm256_cmp_ps(py, one, _CMP_EQ_OQ),
+                                                       _mm256_cmp_ps(py, ymax, _CMP_EQ_OQ)));
+        u = _mm256_mul_ps(u, Select256(hitx, nfriction, one));
+        v = _mm256_mul_ps(v, Select256(hitx, friction, one));
+        v = _mm256_mul_ps(v, Select256(hity, nfriction, one));
+        u = _mm256_mul_ps(u, Select256(hity, friction, one));
+        _mm256_storeu_ps(x + i, px);
+        _mm256_storeu_ps(y + i, py);
+        _mm256_storeu_ps(vx + i, u);
+        _mm256_storeu_ps(vy + i, v);
+    }
+    MoveScalar(params, x + i, y + i, vx + i, vy + i, size + i, n - i);
+}
+
+AVX2_KERNEL static KERNEL_INLINE void ForcesAVX2(const IntegrateParams *params, float *vx,
+                                                 float *vy, const float *jx, const float *jy,
+                                                 size_t n, const bool gravity,
+                                                 const bool brownian) {
+    const __m256 g = _mm256_set1_ps(params->gravity), drag = _mm256_set1_ps(params->drag),
+                 bf = _mm256_set1_ps(params->brown_factor), zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 u = _mm256_loadu_ps(vx + i), v = _mm256_loadu_ps(vy + i);
+        if (gravity) {
+            v = _mm256_add_ps(v, g);
+        }
+        if (brownian) {
+            const __m256 speed = _mm256_sqrt_ps(
+                _mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(v, v)));
+            u = _mm256_add_ps(u, _mm256_mul_ps(_mm256_loadu_ps(jx + i), bf));
+            v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(jy + i), bf));
+            const __m256 len = _mm256_sqrt_ps(
+                _mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(v, v)));
+            const __m256 scale = _mm256_and_ps(_mm256_cmp_ps(len, zero, _CMP_GT_OQ),
+                                               _mm256_div_ps(speed, len));
+            u = _mm256_mul_ps(u, scale);
+            v = _mm256_mul_ps(v, scale);
+        }
+        _mm256_storeu_ps(vx + i, _mm256_mul_ps(u, drag));
+        _mm256_storeu_ps(vy + i, _mm256_mul_ps(v, drag));
+    }
+    ForcesScalar(params, vx + i, vy + i, jx + i, jy + i, n - i, gravity, brownian);
+}
+
+FORCES_VARIANTS(ForcesAVX2, AVX2_KERNEL)
+
+#endif
+
+typedef void (*MoveKernel)(const IntegrateParams *, float *, float *, float *, float *,
+                           const float *, size_t);
+typedef ForcesKernel ForcesTable[2][2];
+
+static const ForcesTable forces_scalar = FORCES_TABLE(ForcesScalar);
+// the kernels every CPU this was built for has
+#if defined(__SSE2__)
+static const ForcesTable forces_sse2 = FORCES_TABLE(ForcesSSE2);
+#define BASE_MOVE MoveSSE2
+#define BASE_FORCES forces_sse2
+#define BASE_BACKEND "sse2"
+#else
+#define BASE_MOVE MoveScalar
+#define BASE_FORCES forces_scalar
+#define BASE_BACKEND "scalar"
+#endif
+static MoveKernel move_kernel = BASE_MOVE;
+static const ForcesTable *forces_kernels = &BASE_FORCES;
+static const char *backend = BASE_BACKEND;
+#if HAVE_AVX2_KERNELS
+static const ForcesTable forces_avx2 = FORCES_TABLE(ForcesAVX2);
+#endif
+
+void IntegrateInit(void) {
+    // from the base kernels, which also undoes IntegrateUseScalar on a CPU without AVX2
+    move_kernel = BASE_MOVE;
+    forces_kernels = &BASE_FORCES;
+    backend = BASE_BACKEND;
+#if HAVE_AVX2_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        move_kernel = MoveAVX2;
+        forces_kernels = &forces_avx2;
+        backend = "avx2";
+    }
+#endif
+}
+
+void IntegrateUseScalar(void) {
+    move_kernel = MoveScalar;
+    forces_kernels = &forces_scalar;
+    backend = "scalar";
+}
+
+const char *IntegrateBackend(void) {
+    return backend;
+}
+
+void IntegrateMove(const IntegrateParams *params, float *x, float *y, float *vx, float *vy,
+                   const float *size, size_t n) {
+    move_kernel(params, x, y, vx, vy, size, n);
+}
+
+ForcesKernel IntegrateForcesKernel(const IntegrateParams *params) {
+    return (*forces_kernels)[params->gravity != 0][params->brown_factor != 0];
+}
+
+void IntegrateForces(const IntegrateParams *params, float *vx, float *vy, const float *jx,
+                     const float *jy, size_t n) {
+    IntegrateForcesKernel(params)(params, vx, vy, jx, jy, n);
+}
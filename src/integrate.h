@@ -0,0 +1,33 @@
+#ifndef INTEGRATE_H
+#define INTEGRATE_H
+
+#include <stddef.h>
+
+typedef struct {
+    float dt;
+    float width, height;  // particles are clamped to [1, width - size] x [1, height - size]
+    float friction_scale; // wall friction is 1 - size * friction_scale
+    float gravity;        // added to vy every step, 0 when gravity is off
+    float brown_factor;   // brownian jitter scale, 0 when brownian motion is off
+    float drag;
+} IntegrateParams;
+
+// pick the widest kernels the cpu supports; safe to call more than once
+void IntegrateInit(void);
+// switch to the scalar reference kernels, until the next IntegrateInit
+void IntegrateUseScalar(void);
+const char *IntegrateBackend(void);
+
+// advance positions by velocity, clamp to the world and apply wall friction
+void IntegrateMove(const IntegrateParams *params, float *x, float *y, float *vx, float *vy,
+                   const float *size, size_t n);
+// apply gravity, brownian jitter (jx/jy in [-1, 1], unused when brown_factor is 0) and drag
+void IntegrateForces(const IntegrateParams *params, float *vx, float *vy, const float *jx,
+                     const float *jy, size_t n);
+// the IntegrateForces variant compiled for params' gravity / brownian toggles, to look up once
+// per step instead of once per call
+typedef void (*ForcesKernel)(const IntegrateParams *params, float *vx, float *vy,
+                             const float *jx, const float *jy, size_t n);
+ForcesKernel IntegrateForcesKernel(const IntegrateParams *params);
+
+#endif
@@ -1,353 +1,192 @@
+#include "capture.h"
+#include "clock.h"
+#include "profile.h"
+#include "render.h"
+#include "sim.h"
+#include "simthread.h"
+#include "snapshot.h"
 #include "raylib.h"
 #include "raymath.h"
-#include <assert.h>
-#include <pthread.h>
+#include "rlgl.h"
 #include <stdio.h>
 #include <stdlib.h>
-
-#ifndef SCREEN_WIDTH
-#define SCREEN_WIDTH (2560)
-#endif
-#ifndef SCREEN_HEIGHT
-#define SCREEN_HEIGHT (SCREEN_WIDTH * 9 / 16)
-#endif
-
-#define SCALE (SCREEN_WIDTH / 800)
+#include <string.h>
 
 #define WINDOW_TITLE "Particles"
 
-#define MAX_PARTICLES 4500
-
-#define NUM_BARRIERS 10
-
-#define PARTICLE_INTERVAL 1
-#define PARTICLE_SIZE (5.f * SCALE)
-
-#define EMITTER_SIZE (20.f * SCALE)
-#define MAX_ESIZE (30.f * SCALE)
-#define MIN_ESIZE (5.f * SCALE)
-
 #define TEXT_SIZE (12 * SCALE)
 #define TEXT_OFFSET (8 * SCALE)
 
-#define TIMESCALE 10
 #define AVG_KEEP 25
+// width of the profiler's bars, and the p99 they are scaled to at least
+#define PROF_BAR_WIDTH (120 * SCALE)
+#define PROF_BAR_MIN_SCALE 1e-3
 
-#define NUMTHREADS 8
-
-#define min(a, b) ((a) > (b) ? (b) : (a))
-#define max(a, b) ((a) > (b) ? (a) : (b))
-#define flteq(a, b) (fabs((a) - (b)) < .5)
+// zoom per notch of the mouse wheel, and how far in it goes; out it stops once the whole world
+// fits in half the window
+#define ZOOM_STEP 1.1f
+#define MAX_ZOOM 8.f
 
-typedef struct {
-    Vector2 pos;
-    Vector2 velocity;
-    Color color;
-    float size;
-} Box;
+// seconds between refreshes of the FPS line
+#define FPS_INTERVAL .5
 
-typedef struct {
-    Vector2 pos;
-    Vector2 velocity;
-    Color color;
-    float size;
-    Box particles[MAX_PARTICLES];
-    size_t count, next;
-} Emitter;
-
-static Emitter e = {(Vector2){SCREEN_WIDTH / 2.f, SCREEN_HEIGHT / 2.f},
-                    (Vector2){-80.f, -80.f},
-                    (Color){0xFF, 0xFF, 0xFF, 0xFF},
-                    EMITTER_SIZE,
-                    {0},
-                    0,
-                    0};
-
-//static const Rectangle barrier = (Rectangle) {500, 300, 200, 100};
-static Rectangle barriers[NUM_BARRIERS];
 static const Color barrierColor = SKYBLUE;
-static char fpsbuf[128], posbuf[128], velbuf[128], flagsbuf[512];
-static bool b_gravity, b_brownian, b_nwtn3rd, b_repulsion, b_solitaire, b_rocket[4] = {0},
-                                                                        b_menuopen;
-static size_t frames = 0;
-typedef enum { UP, DOWN, LEFT, RIGHT } Dir;
-typedef enum { AXIS_X, AXIS_Y } Axis;
-static double repulsion_radius = 1.75, repulsion_factor = 2, brown_factor = .25;
-
-void CalcVelocityAfterCollision(Box *e, const Axis a) {
-    double friction = (1 - ((e->size) / (MAX_ESIZE * 2)));
-    switch (a) {
-    case AXIS_X:
-        e->velocity.x *= -friction;
-        e->velocity.y *= friction;
-        break;
-    case AXIS_Y:
-        e->velocity.y *= -friction;
-        e->velocity.x *= friction;
-        break;
+static char fpsbuf[128], posbuf[128], velbuf[128], flagsbuf[1024];
+static bool b_solitaire, b_menuopen, b_batched, b_profile, b_hud_cached;
+static CaptureFormat capture_format;
+static size_t render_frames = 0;
+// the window's view into the world
+static Camera2D camera;
+
+// everything the HUD is made from; the text is only formatted and the HUD layer only
+// rasterized again when one of these changes
+typedef struct {
+    int fps;
+    bool menu;
+    // the rest stay zero while the menu is closed
+    bool profile, solitaire, recording, capturing;
+    bool gravity, brownian, nwtn3rd, repulsion, barnes_hut;
+    size_t capture_dropped;
+    Vector2 avg_pos, avg_vel;
+    double repulsion_radius, repulsion_factor, brown_factor, opening_angle;
+    float emitter_size, world_width, world_height, zoom;
+    size_t num_emitters, active_emitter;
+} HudKey;
+
+// the HUD as drawn last, in premultiplied alpha
+static RenderTexture2D hud;
+static HudKey hud_key;
+static bool hud_dirty = true;
+
+void DrawBox(const Vector2 pos, const float size, const Color color) {
+    DrawRectangleV(pos, (Vector2){size, size}, color);
+    if (!b_solitaire) {
+        //solitaire-mode trails need to show particle color, so don't draw outlines
+        DrawRectangleLinesEx((Rectangle){pos.x, pos.y, size, size}, 2.f, BLACK);
     }
 }
 
-void UpdateBoxPosition(Box *b, const float deltaTime) {
-    float size = max(b->size, 0);
-    b->pos = Vector2Clamp(Vector2Add(b->pos, Vector2Scale(b->velocity, deltaTime)),
-                          (Vector2){1.f, 1.f},
-                          (Vector2){SCREEN_WIDTH - size, SCREEN_HEIGHT - size});
-    double speed = Vector2Length(b->velocity);
-
-    const Rectangle cur = (Rectangle){b->pos.x, b->pos.y, size, size};
-    if (speed > .01 && (b->pos.x == 1 || b->pos.x == SCREEN_WIDTH - size)) {
-        CalcVelocityAfterCollision(b, AXIS_X);
-    }
-    if (speed > .01 && (b->pos.y == 1 || b->pos.y == SCREEN_HEIGHT - size)) {
-        CalcVelocityAfterCollision(b, AXIS_Y);
-    }
-    for (int i = 0; i < NUM_BARRIERS; ++i) {
-        const Rectangle barrier = barriers[i], top = {barrier.x, barrier.y, barrier.width, 1},
-                        bot = {barrier.x, barrier.y + barrier.height, barrier.width, 1},
-                        left = {barrier.x, barrier.y, 1, barrier.height},
-                        right = {barrier.x + barrier.width, barrier.y, 1, barrier.height},
-                        topCol = GetCollisionRec(cur, top), botCol = GetCollisionRec(cur, bot),
-                        leftCol = GetCollisionRec(cur, left),
-                        rightCol = GetCollisionRec(cur, right);
-        const float vertIsect = max(topCol.width, botCol.width),
-                    horzIsect = max(leftCol.height, rightCol.height);
-        if (vertIsect > horzIsect) {
-            if (topCol.width > 0) {
-                b->pos.y = top.y - size;
-            } else if (botCol.width > 0) {
-                b->pos.y = bot.y + 1;
-            }
-            if (topCol.width > 0 || botCol.width > 0) {
-                CalcVelocityAfterCollision(b, AXIS_Y);
-            }
-        } else {
-            if (leftCol.height > 0) {
-                b->pos.x = left.x - size;
-            } else if (rightCol.height > 0) {
-                b->pos.x = right.x + 1;
-            }
-            if (leftCol.height > 0 || rightCol.height > 0) {
-                CalcVelocityAfterCollision(b, AXIS_X);
-            }
-        }
-    }
-    if (b_gravity) {
-        b->velocity = Vector2Add(b->velocity, Vector2Scale((Vector2){0, 5.f}, deltaTime));
-    }
-    speed = Vector2Length(b->velocity);
-    if (b != (Box *) &e && b_brownian) {
-        b->velocity = Vector2Normalize(
-            Vector2Add(b->velocity,
-                       Vector2Scale((Vector2){(float) GetRandomValue(-16, 16) / 16.f,
-                                              (float) GetRandomValue(-16, 16) / 16.f},
-                                    brown_factor)));
-        b->velocity = Vector2Scale(b->velocity, speed);
-    }
-    //drag
-    b->velocity = Vector2Scale(b->velocity, .99995);
+void DrawParticle(const RenderState *rs, const size_t i, const float lead) {
+    DrawBox((Vector2){rs->x[i] + rs->vx[i] * lead, rs->y[i] + rs->vy[i] * lead},
+            rs->size[i],
+            palette_color(rs->age[i]));
 }
 
-void UpdateParticle(Box *p) {
-    const double increment = (double) (MAX_PARTICLES);
+// commands the sim thread's queue had no room for, sent ahead of anything newer
+#define BACKLOG_SIZE 64
+static SimCommand backlog[BACKLOG_SIZE];
+static size_t backlog_count;
 
-    Vector3 hsv = ColorToHSV(p->color);
-    if (hsv.x >= 360.f) {
-        hsv.x = 10;
+// send what is backlogged, in order; false if some of it is still waiting
+bool FlushBacklog(void) {
+    size_t sent = 0;
+    while (sent < backlog_count && SimThreadSend(backlog[sent])) {
+        sent++;
     }
-    hsv.x += (720. * (MAX_PARTICLES / 1000.)) / (increment);
-    // hsv.y -= .1 / increment;
-    //hsv.z -= .1 / increment;
-    p->size -= (PARTICLE_SIZE / 1.5) / increment;
-    p->color = ColorFromHSV(hsv.x, hsv.y, hsv.z);
+    memmove(backlog, backlog + sent, (backlog_count - sent) * sizeof(*backlog));
+    backlog_count -= sent;
+    return backlog_count == 0;
 }
 
-static double ratio = PARTICLE_SIZE / (EMITTER_SIZE * (1000 / (PARTICLE_INTERVAL * 70)));
-
-void emitParticle(Emitter *e) {
-    Box *p = &e->particles[e->next];
-    p->size = PARTICLE_SIZE;
-    p->color = RED;
-    static Vector2 pos_offset = {PARTICLE_SIZE / 2., PARTICLE_SIZE / 2.};
-    pos_offset.x += p->size;
-    if (pos_offset.x > e->size - PARTICLE_SIZE) {
-        pos_offset.x = e->size > PARTICLE_SIZE * 2 ? PARTICLE_SIZE / 2. : 0;
-        pos_offset.y += p->size;
-    }
-    if (pos_offset.y > e->size - PARTICLE_SIZE) {
-        pos_offset.y = e->size > PARTICLE_SIZE * 2 ? PARTICLE_SIZE / 2. : 0;
-    }
-    if (b_nwtn3rd && e->size > PARTICLE_SIZE * 2) {
-        if (b_rocket[UP] || b_rocket[DOWN]) {
-            pos_offset.y = b_rocket[UP] ? e->size - PARTICLE_SIZE : 0;
-        }
-        if (b_rocket[LEFT]) {
-            pos_offset.x = e->size - PARTICLE_SIZE;
-        }
-        if (b_rocket[RIGHT]) {
-            pos_offset.x = 0;
-        }
-    }
-    p->pos = Vector2Add((Vector2){e->pos.x, e->pos.y}, pos_offset);
-    if (b_rocket[RIGHT]) {
-        pos_offset.y += p->size;
-    }
-    Vector2 fuzz = (Vector2){(float) GetRandomValue(-64, 64) / 8.,
-                             (float) GetRandomValue(-128, 128) / 8.};
-
-    fuzz = Vector2Add(Vector2Scale(e->velocity, ratio), fuzz);
-    if (b_nwtn3rd) {
-        if (b_rocket[UP]) {
-            if (fuzz.y < 0)
-                fuzz.y = -1. * fuzz.y;
-        } else if (b_rocket[DOWN]) {
-            if (fuzz.y > 0)
-                fuzz.y = -1 * fuzz.y;
-        }
-        if (b_rocket[LEFT]) {
-            if (fuzz.x < 0)
-                fuzz.x = -1 * fuzz.x;
-        } else if (b_rocket[RIGHT]) {
-            if (fuzz.x > 0)
-                fuzz.x = -1 * fuzz.x;
-        }
-    }
-    p->velocity = fuzz;
-    if (b_nwtn3rd) {
-        e->velocity = Vector2Subtract(e->velocity,
-                                      Vector2Scale(fuzz, GetFrameTime() * ratio * 1024));
-    }
-
-    if (e->next + 1 < MAX_PARTICLES && e->next >= e->count) {
-        e->count++;
+// SimThreadSend that keeps commands in order and holds them back while the queue is full
+void Send(const SimCommand cmd) {
+    if (FlushBacklog() && SimThreadSend(cmd)) {
+        return;
     }
-    e->next++;
-    if (e->next >= MAX_PARTICLES) {
-        e->next = 0;
+    if (backlog_count == BACKLOG_SIZE) {
+        fprintf(stderr, "the simulation isn't keeping up, dropped command %d\n", cmd.type);
+        return;
     }
+    backlog[backlog_count++] = cmd;
 }
 
-static const size_t CELL_SIZE = 64;
-
-#define box_center_pos(BOX) Vector2Add((BOX).pos, (Vector2){(BOX).size / 2., (BOX).size / 2.})
-
-#define distance_from_emitter(BOX) (Vector2Distance(box_center_pos((BOX)), box_center_pos(e)))
-
-#define distance_from_particle(BOX1, BOX2) \
-    (Vector2Distance(box_center_pos((BOX1)), box_center_pos((BOX2))))
-
-#define get_cell(BOX) \
-    ((struct { int x, y; }){(int) (BOX).pos.x / CELL_SIZE, (int) (BOX).pos.y / CELL_SIZE})
-
-#define in_same_cell(BOX1, BOX2) \
-    (abs(get_cell((BOX1)).x - get_cell((BOX2)).x) < 2 \
-     && abs(get_cell((BOX1)).y - get_cell((BOX2)).y) < 2)
-
-void RepulseBox(Box *p, const Box *repulsor, const double dt) {
-    const float radius = max(p->size, repulsor->size) * repulsion_radius;
-    const float dist = distance_from_particle(*p, *repulsor);
-    if (dist < radius) {
-        const float size_ratio = repulsor->size / p->size;
-        const Vector2 direction = Vector2Normalize(
-            Vector2Subtract(box_center_pos(*p), box_center_pos(*repulsor)));
-        const float intensity = Clamp((radius) / ((dist / (radius / 2)) * (dist / (radius / 2))),
-                                      0,
-                                      100);
-        float factor = repulsion_factor;
-        const Vector2 deltaV = Vector2Scale(direction, dt * size_ratio * factor * intensity);
-        p->velocity = Vector2Add(p->velocity, deltaV);
-    }
-}
-
-void *DoRepulsionForBox(void *arg) {
-    const double dt = GetFrameTime();
-    size_t offset = (size_t) arg;
-    assert(offset < NUMTHREADS);
-    Box *boxes = e.particles;
-    for (int i = offset; i < e.count; i += NUMTHREADS) {
-        if (boxes[i].size > 0) {
-            RepulseBox(&boxes[i], (Box *) &e, dt);
-            for (int j = 0; j < e.count; j++) {
-                if (boxes[j].size > 0 && j != i && in_same_cell(boxes[i], boxes[j])) {
-                    RepulseBox(&boxes[i], &boxes[j], dt);
-                }
-            }
-        }
-    }
-    return 0;
-}
-static pthread_t tid[NUMTHREADS];
-void DoBoxRepulsion() {
-    for (size_t i = 0; i < NUMTHREADS; i++) {
-        pthread_create(&tid[i], NULL, DoRepulsionForBox, (void *) i);
-    }
-    for (size_t i = 0; i < NUMTHREADS; i++) {
-        pthread_join(tid[i], NULL);
-    }
-}
-
-void generateRandomBarriers(void){
-    for (int i = 0; i < NUM_BARRIERS; ++i) {
-        barriers[i] = (Rectangle){GetRandomValue(128, SCREEN_WIDTH - 128),
-                                  GetRandomValue(128, SCREEN_HEIGHT - 128),
-                                  GetRandomValue(48, 480),
-                                  GetRandomValue(48, 480)};
-        if (barriers[i].x + barriers[i].width > SCREEN_WIDTH - 128
-            || barriers[i].y + barriers[i].height > SCREEN_HEIGHT - 128) {
-            //no barriers go off screen
-            i--;
-            continue;
-        }
-        for (int j = 0; j < i; ++j) {
-            Rectangle collision = GetCollisionRec(barriers[i], barriers[j]);
-            if (collision.height > 0 || collision.width > 0) {
-                //no 2 barriers can intersect
-                i--;
-                break;
-            }
-        }
-    }
+#define send_step(TYPE, STEP) Send((SimCommand){(TYPE), 0, (Vector2){(STEP), 0}})
+
+// right-drag pans, the wheel zooms about the cursor, and the middle of the view stays in the world
+void HandleCamera(const RenderState *rs) {
+    if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
+        camera.target = Vector2Subtract(camera.target,
+                                        Vector2Scale(GetMouseDelta(), 1.f / camera.zoom));
+    }
+    const float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+        const float fit = min(SCREEN_WIDTH / rs->world_width, SCREEN_HEIGHT / rs->world_height);
+        const float zoom =
+            Clamp(camera.zoom * powf(ZOOM_STEP, wheel), min(fit, 1.f) / 2, MAX_ZOOM);
+        // keep the world point under the cursor where it is
+        const Vector2 cursor = GetScreenToWorld2D(GetMousePosition(), camera);
+        camera.target = Vector2Add(cursor,
+                                   Vector2Scale(Vector2Subtract(camera.target, cursor),
+                                                camera.zoom / zoom));
+        camera.zoom = zoom;
+    }
+    camera.target = Vector2Clamp(camera.target,
+                                 Vector2Zero(),
+                                 (Vector2){rs->world_width, rs->world_height});
 }
 
-void DrawBox(Box *b) {
-    DrawRectangleV(b->pos, (Vector2){b->size, b->size}, b->color);
-    if (!b_solitaire) {
-        //solitaire-mode trails need to show particle color, so don't draw outlines
-        DrawRectangleLinesEx((Rectangle){b->pos.x, b->pos.y, b->size, b->size}, 2.f, BLACK);
-    }
-}
+// the thrust last sent; the sim holds it until told otherwise
+static unsigned thrust_sent;
 
-void HandleInput(Emitter *e) {
+void HandleInput(const RenderState *rs) {
+    FlushBacklog();
+    HandleCamera(rs);
     switch (GetKeyPressed()) {
     case KEY_KP_0:
-        e->velocity = Vector2Zero();
-        for (int i = 0; i < e->count; i++) {
-            e->particles[i].velocity = Vector2Zero();
-        }
+        Send((SimCommand){CMD_STOP_ALL});
         break;
     case KEY_R:
-        generateRandomBarriers();
-        e->count = 0;
-        e->next = 0;
+        Send((SimCommand){CMD_REGENERATE});
         break;
     case KEY_G:
-        b_gravity = !b_gravity;
+        Send((SimCommand){CMD_TOGGLE_GRAVITY});
         break;
     case KEY_B:
-        b_brownian = !b_brownian;
+        Send((SimCommand){CMD_TOGGLE_BROWNIAN});
         break;
     case KEY_N:
-        b_nwtn3rd = !b_nwtn3rd;
+        Send((SimCommand){CMD_TOGGLE_NWTN3RD});
         break;
     case KEY_L:
         b_solitaire = !b_solitaire;
         break;
     case KEY_P:
-        b_repulsion = !b_repulsion;
+        Send((SimCommand){CMD_TOGGLE_REPULSION});
+        break;
+    case KEY_H:
+        Send((SimCommand){CMD_TOGGLE_BARNES_HUT});
         break;
     case KEY_M:
         b_menuopen = !b_menuopen;
         break;
+    case KEY_F:
+        b_profile = !b_profile;
+        break;
+    case KEY_F5:
+        SimThreadSnapshot();
+        break;
+    case KEY_F6:
+        SimThreadRecord(!SimThreadRecording());
+        break;
+    case KEY_F7:
+        if (Capturing()) {
+            CaptureStop();
+        } else {
+            char name[64];
+            snprintf(name, sizeof(name), "capture-%zu", rs->frames);
+            CaptureStart(name, capture_format, GetRenderWidth(), GetRenderHeight());
+        }
+        break;
+    case KEY_E:
+        Send(
+            (SimCommand){CMD_SPAWN_EMITTER, 0, GetScreenToWorld2D(GetMousePosition(), camera)});
+        // the new active emitter starts without any, hand it the keys still held
+        thrust_sent = 0;
+        break;
+    case KEY_TAB:
+        Send((SimCommand){CMD_NEXT_EMITTER});
+        thrust_sent = 0;
+        break;
     case KEY_ESCAPE:
         if (b_menuopen) {
             b_menuopen = false;
@@ -364,105 +203,83 @@ void HandleInput(Emitter *e) {
     default:
         break;
     }
-    if (frames % 10 == 0) {
-        if (IsKeyDown(KEY_COMMA) && e->size > MIN_ESIZE) {
-            e->size -= .5;
-            ratio = PARTICLE_SIZE / (e->size * (MAX_PARTICLES / (PARTICLE_INTERVAL * 70)));
+    if (render_frames % 10 == 0) {
+        if (IsKeyDown(KEY_COMMA)) {
+            send_step(CMD_EMITTER_SIZE, -.5);
+        }
+        if (IsKeyDown(KEY_PERIOD)) {
+            send_step(CMD_EMITTER_SIZE, .5);
         }
-        if (IsKeyDown(KEY_PERIOD) && e->size < MAX_ESIZE) {
-            e->size += .5;
-            ratio = PARTICLE_SIZE / (e->size * (MAX_PARTICLES / (PARTICLE_INTERVAL * 70)));
+        if (IsKeyDown(KEY_SEMICOLON)) {
+            send_step(CMD_REPULSION_RADIUS, -.01);
         }
-        if (IsKeyDown(KEY_SEMICOLON) && repulsion_radius > .01) {
-            repulsion_radius -= .01;
+        if (IsKeyDown(KEY_APOSTROPHE)) {
+            send_step(CMD_REPULSION_RADIUS, .01);
         }
-        if (IsKeyDown(KEY_APOSTROPHE) && repulsion_radius < 10) {
-            repulsion_radius += .01;
+        if (IsKeyDown(KEY_LEFT_BRACKET)) {
+            send_step(CMD_REPULSION_FACTOR, -.01);
         }
-        if (IsKeyDown(KEY_LEFT_BRACKET) && repulsion_factor > -10.) {
-            repulsion_factor -= .01;
+        if (IsKeyDown(KEY_RIGHT_BRACKET)) {
+            send_step(CMD_REPULSION_FACTOR, .01);
         }
-        if (IsKeyDown(KEY_RIGHT_BRACKET) && repulsion_factor < 10.) {
-            repulsion_factor += .01;
+        if (IsKeyDown(KEY_I)) {
+            send_step(CMD_OPENING_ANGLE, -.01);
         }
-        if (IsKeyDown(KEY_MINUS) && brown_factor > 0.01) {
-            brown_factor -= .01;
+        if (IsKeyDown(KEY_O)) {
+            send_step(CMD_OPENING_ANGLE, .01);
         }
-        if (IsKeyDown(KEY_EQUAL) && brown_factor < 2.) {
-            brown_factor += .01;
+        if (IsKeyDown(KEY_MINUS)) {
+            send_step(CMD_BROWN_FACTOR, -.01);
+        }
+        if (IsKeyDown(KEY_EQUAL)) {
+            send_step(CMD_BROWN_FACTOR, .01);
         }
     }
     if (IsKeyDown(KEY_ZERO)) {
-        e->velocity = Vector2Zero();
+        Send((SimCommand){CMD_STOP_EMITTER});
     }
+    unsigned dirs = 0;
     if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W)) {
-        if (b_nwtn3rd) {
-            b_rocket[UP] = true;
-        } else {
-            e->velocity = Vector2Clamp(Vector2Add(e->velocity, (Vector2){0., -0.5}),
-                                       (Vector2){-100, -100},
-                                       (Vector2){100, 100});
-        }
-    } else {
-        b_rocket[UP] = false;
+        dirs |= 1u << UP;
     }
     if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S)) {
-        if (b_nwtn3rd) {
-            b_rocket[DOWN] = true;
-        } else {
-            e->velocity = Vector2Clamp(Vector2Add(e->velocity, (Vector2){0., 0.5}),
-                                       (Vector2){-100, -100},
-                                       (Vector2){100, 100});
-        }
-    } else {
-        b_rocket[DOWN] = false;
+        dirs |= 1u << DOWN;
     }
     if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A)) {
-        if (b_nwtn3rd) {
-            b_rocket[LEFT] = true;
-        } else {
-            e->velocity = Vector2Clamp(Vector2Add(e->velocity, (Vector2){-0.5, 0.}),
-                                       (Vector2){-100, -100},
-                                       (Vector2){100, 100});
-        }
-    } else {
-        b_rocket[LEFT] = false;
+        dirs |= 1u << LEFT;
     }
-
     if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D)) {
-        if (b_nwtn3rd) {
-            b_rocket[RIGHT] = true;
-        } else {
-            e->velocity = Vector2Clamp(Vector2Add(e->velocity, (Vector2){0.5, 0.}),
-                                       (Vector2){-100, -100},
-                                       (Vector2){100, 100});
-        }
-    } else {
-        b_rocket[RIGHT] = false;
+        dirs |= 1u << RIGHT;
+    }
+    if (dirs != thrust_sent) {
+        Send((SimCommand){CMD_THRUST, dirs});
+        thrust_sent = dirs;
     }
     {
         static Vector2 hVel = (Vector2){0.0f, 0.0f};
         if (IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
-            e->pos = GetMousePosition();
-            e->velocity = Vector2Zero();
+            Send((SimCommand){CMD_MOVE_EMITTER,
+                                       0,
+                                       GetScreenToWorld2D(GetMousePosition(), camera)});
             hVel = Vector2Add(hVel,
                               Vector2Scale(Vector2Divide(GetMouseDelta(),
                                                          (Vector2){SCREEN_WIDTH, SCREEN_HEIGHT}),
-                                           1. / GetFrameTime()));
+                                           1. / (GetFrameTime() * camera.zoom)));
         }
         if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) {
-            e->velocity = Vector2Scale(hVel, 1);
+            Send((SimCommand){CMD_THROW_EMITTER, 0, Vector2Scale(hVel, 1)});
             hVel = Vector2Zero();
         }
     }
 }
 
-void DoTextStuff(Emitter *e) {
+void DoTextStuff(const RenderState *rs) {
+    const EmitterState *active = &rs->emitters[rs->active_emitter];
     static Vector2 histPos[AVG_KEEP] = {0}, histVel[AVG_KEEP] = {0};
-    histPos[frames % AVG_KEEP] = e->pos;
-    histVel[frames % AVG_KEEP] = e->velocity;
+    histPos[render_frames % AVG_KEEP] = active->pos;
+    histVel[render_frames % AVG_KEEP] = active->velocity;
     static Vector2 avgPos = {0}, avgVel = {0};
-    if (frames % AVG_KEEP == 0) {
+    if (render_frames % AVG_KEEP == 0) {
         avgPos = Vector2Zero();
         avgVel = Vector2Zero();
         for (size_t i = 0; i < AVG_KEEP; i++) {
@@ -470,69 +287,152 @@ void DoTextStuff(Emitter *e) {
             avgVel = Vector2Add(avgVel, Vector2Scale(histVel[i], .1));
         }
     }
-    sprintf(fpsbuf, "FPS: %d", GetFPS());
+    static int fps;
+    static double fps_time = -FPS_INTERVAL;
+    if (GetTime() - fps_time >= FPS_INTERVAL) {
+        fps = GetFPS();
+        fps_time = GetTime();
+    }
 
-    static const char *BOOLSTRINGS[2] = {"false", "true"};
+    // zeroed first so padding compares equal too
+    HudKey key;
+    memset(&key, 0, sizeof(key));
+    key.fps = fps;
+    key.menu = b_menuopen;
     if (b_menuopen) {
-        sprintf(posbuf, "Position: (%-5.2F, % -5.2F)", avgPos.x, avgPos.y);
-        sprintf(velbuf, "Velocity: (%-7.2F, % -7.2F)", avgVel.x, avgVel.y);
+        key.profile = b_profile;
+        key.solitaire = b_solitaire;
+        key.recording = SimThreadRecording();
+        key.capturing = Capturing();
+        key.capture_dropped = CaptureDropped();
+        key.gravity = rs->gravity;
+        key.brownian = rs->brownian;
+        key.nwtn3rd = rs->nwtn3rd;
+        key.repulsion = rs->repulsion;
+        key.barnes_hut = rs->barnes_hut;
+        key.avg_pos = avgPos;
+        key.avg_vel = avgVel;
+        key.repulsion_radius = rs->repulsion_radius;
+        key.repulsion_factor = rs->repulsion_factor;
+        key.brown_factor = rs->brown_factor;
+        key.opening_angle = rs->opening_angle;
+        key.emitter_size = active->size;
+        key.world_width = rs->world_width;
+        key.world_height = rs->world_height;
+        key.zoom = camera.zoom;
+        key.num_emitters = rs->num_emitters;
+        key.active_emitter = rs->active_emitter;
+    }
+    if (!hud_dirty && !memcmp(&key, &hud_key, sizeof(key))) {
+        return;
+    }
+    hud_key = key;
+    hud_dirty = true;
+    sprintf(fpsbuf, "FPS: %d", key.fps);
+
+    static const char *BOOLSTRINGS[2] = {"false", "true"};
+    if (key.menu) {
+        sprintf(posbuf, "Position: (%-5.2F, % -5.2F)", key.avg_pos.x, key.avg_pos.y);
+        sprintf(velbuf, "Velocity: (%-7.2F, % -7.2F)", key.avg_vel.x, key.avg_vel.y);
         sprintf(flagsbuf,
                 "Show / Hide Menu [M]\n\nGravity [G]: %s\n\nBrownian [B]: %s\n\t(< - + >factor = "
                 "%.2f)\n\nNewton's 3rd "
                 "[N]: %s\n\n"
-                "Repulsion [P]: %s\n\t(< ; ' >radius = %.2f,\n\t < [ ] >factor = %.2f)\n\nXP "
+                "Repulsion [P]: %s\n\t(< ; ' >radius = %.2f,\n\t < [ ] >factor = %.2f)\n"
+                "\tBarnes-Hut [H]: %s\n\t(< I O >angle = %.2f)\n\nXP "
                 "Solitaire[L]: %s\n\n"
                 "Emitter Size: %.0fpx\n\t(< , . >)\n\n"
+                "Emitters: %zu, steering #%zu\n\t(add at cursor [E],\n\t next [Tab])\n\n"
+                "World: %.0fx%.0f, zoom %.2fx\n\t(pan [Right drag],\n\t zoom [Wheel])\n\n"
+                "Profiler [F]: %s\n\n"
+                "Snapshot [F5]\n\nRecord [F6]: %s\n\n"
+                "Capture [F7]: %s\n\t(%zu frames dropped)\n\n"
                 "Regenerate colliders [R]\n\n"
                 "WASD/\n\tArrows/\n\t\tClick+Drag\n to move Emitter\n\n"
                 "Set Emitter\n\tvelocity to 0 [0]\n\n"
                 "Set ALL\n\tvelocities to 0 [kp_0]",
-                BOOLSTRINGS[!!b_gravity],
-                BOOLSTRINGS[!!b_brownian],
-                brown_factor,
-                BOOLSTRINGS[!!b_nwtn3rd],
-                BOOLSTRINGS[!!b_repulsion],
-                repulsion_radius,
-                repulsion_factor,
-                BOOLSTRINGS[!!b_solitaire],
-                e->size);
+                BOOLSTRINGS[key.gravity],
+                BOOLSTRINGS[key.brownian],
+                key.brown_factor,
+                BOOLSTRINGS[key.nwtn3rd],
+                BOOLSTRINGS[key.repulsion],
+                key.repulsion_radius,
+                key.repulsion_factor,
+                BOOLSTRINGS[key.barnes_hut],
+                key.opening_angle,
+                BOOLSTRINGS[key.solitaire],
+                key.emitter_size,
+                key.num_emitters,
+                key.active_emitter + 1,
+                key.world_width,
+                key.world_height,
+                key.zoom,
+                BOOLSTRINGS[key.profile],
+                BOOLSTRINGS[key.recording],
+                BOOLSTRINGS[key.capturing],
+                key.capture_dropped);
     } else {
         sprintf(flagsbuf, "Show / Hide Menu [M]\n\n");
     }
 }
 
-void Draw(Emitter *e) {
-    const Vector2 text_size = MeasureTextEx(GetFontDefault(), fpsbuf, TEXT_SIZE, 1);
-    BeginDrawing();
-    if (!b_solitaire) {
-        ClearBackground(CLITERAL(Color){0x22, 0x22, 0x22, 0xFF});
+// percentiles are sorted out of the whole ring, so only every AVG_KEEP frames
+static struct {
+    double p50[PROF_STAGES], p99[PROF_STAGES], scale;
+    double busy[PROF_MAX_WORKERS];
+    size_t workers;
+} prof;
+
+void UpdateProfilerStats(void) {
+    prof.scale = PROF_BAR_MIN_SCALE;
+    for (int s = 0; s < PROF_STAGES; s++) {
+        ProfPercentiles(s, &prof.p50[s], &prof.p99[s]);
+        prof.scale = max(prof.scale, prof.p99[s]);
     }
-    for (int i = 0; i < NUM_BARRIERS; ++i) {
-        DrawRectangleRec(barriers[i], barrierColor);
-        DrawRectangleLinesEx(barriers[i], 4.f, BLACK);
+    prof.workers = min(ProfWorkers(), PROF_MAX_WORKERS);
+    for (size_t w = 0; w < prof.workers; w++) {
+        prof.busy[w] = ProfWorkerMean(w);
     }
+    hud_dirty = true;
+}
 
-    if (e->count > e->next) {
-        for (size_t i = e->next + 1; i < e->count; i++) {
-            if (e->particles[i].size > 0)
-                DrawBox(&e->particles[i]);
-        }
-        for (size_t i = 0; i < e->next + 1; i++) {
-            if (e->particles[i].size > 0)
-                DrawBox(&e->particles[i]);
-        }
-    } else {
-        for (size_t i = 0; i < e->count; i++) {
-            if (e->particles[i].size > 0)
-                DrawBox(&e->particles[i]);
-        }
+// one row per stage, p50 / p99 in ms with a bar for each, then the repulsion workers' mean busy
+// time per tick
+void DrawProfiler(const float x, const float y) {
+    const float font_size = TEXT_SIZE / 1.25, row = font_size + TEXT_OFFSET / 2;
+    const float numbers = x + MeasureText("repulsion  ", font_size);
+    const float bars = numbers + MeasureText("00.000 / 00.000 ms  ", font_size);
+    char buf[64];
+    DrawText("stage", x, y, font_size, RAYWHITE);
+    DrawText("p50 / p99", numbers, y, font_size, RAYWHITE);
+    float ry = y + row;
+    for (int s = 0; s < PROF_STAGES; s++, ry += row) {
+        snprintf(buf, sizeof(buf), "%6.3f / %6.3f ms", prof.p50[s] * 1e3, prof.p99[s] * 1e3);
+        DrawText(ProfStageName(s), x, ry, font_size, RAYWHITE);
+        DrawText(buf, numbers, ry, font_size, RAYWHITE);
+        // p99 behind, p50 in front
+        DrawRectangleRec((Rectangle){bars, ry, PROF_BAR_WIDTH * prof.p99[s] / prof.scale, font_size},
+                         GetColor(0xE0603080));
+        DrawRectangleRec((Rectangle){bars, ry, PROF_BAR_WIDTH * prof.p50[s] / prof.scale, font_size},
+                         GetColor(0x60C060FF));
+    }
+    ry += row;
+    for (size_t w = 0; w < prof.workers; w++, ry += row) {
+        snprintf(buf, sizeof(buf), "worker %zu", w);
+        DrawText(buf, x, ry, font_size, RAYWHITE);
+        snprintf(buf, sizeof(buf), "%6.3f ms busy", prof.busy[w] * 1e3);
+        DrawText(buf, numbers, ry, font_size, RAYWHITE);
     }
-    DrawBox((Box *) e);
-    if (b_menuopen) {
+}
+
+// the menu, stats and profiler panels in screen space, from the text DoTextStuff formatted
+void DrawHud(void) {
+    const Vector2 text_size = MeasureTextEx(GetFontDefault(), fpsbuf, TEXT_SIZE, 1);
+    const Vector2 flags_size = MeasureTextEx(GetFontDefault(), flagsbuf, TEXT_SIZE, 1);
+    if (hud_key.menu) {
         DrawRectangleRec((Rectangle){TEXT_OFFSET / 2,
                                      TEXT_OFFSET / 2,
-                                     MeasureTextEx(GetFontDefault(), flagsbuf, TEXT_SIZE, 1).x
-                                         + TEXT_OFFSET,
+                                     flags_size.x + TEXT_OFFSET,
                                      SCREEN_HEIGHT - TEXT_OFFSET},
                          GetColor(0x0A0A0A55));
         DrawText(fpsbuf,
@@ -551,61 +451,187 @@ void Draw(Emitter *e) {
                  TEXT_SIZE / 1.25,
                  RAYWHITE);
         DrawText(flagsbuf, TEXT_OFFSET, (TEXT_OFFSET), TEXT_SIZE / 1.25, RAYWHITE);
+        if (hud_key.profile) {
+            const float x = flags_size.x + 2 * TEXT_OFFSET;
+            const float width = MeasureText("repulsion  00.000 / 00.000 ms  ", TEXT_SIZE / 1.25)
+                                + PROF_BAR_WIDTH + TEXT_OFFSET;
+            const float height = (PROF_STAGES + prof.workers + 2)
+                                 * (TEXT_SIZE / 1.25 + TEXT_OFFSET / 2);
+            DrawRectangleRec((Rectangle){x - TEXT_OFFSET / 2, TEXT_OFFSET / 2, width, height},
+                             GetColor(0x0A0A0A55));
+            DrawProfiler(x, TEXT_OFFSET);
+        }
     } else {
-        Vector2 flgbuf_size = MeasureTextEx(GetFontDefault(), flagsbuf, TEXT_SIZE, 1);
         DrawRectangleRec((Rectangle){TEXT_OFFSET / 2,
                                      TEXT_OFFSET / 2,
-                                     flgbuf_size.x + TEXT_OFFSET,
-                                     flgbuf_size.y + TEXT_OFFSET},
+                                     flags_size.x + TEXT_OFFSET,
+                                     flags_size.y + TEXT_OFFSET},
                          GetColor(0x0A0A0A55));
         DrawText(fpsbuf, TEXT_OFFSET, TEXT_OFFSET * 4, TEXT_SIZE / 1.25, RAYWHITE);
         DrawText(flagsbuf, TEXT_OFFSET, TEXT_OFFSET, TEXT_SIZE / 1.25, RAYWHITE);
     }
+}
+
+// redraw the HUD into its texture. Colour and coverage are blended separately so what ends up
+// in the texture is premultiplied, and the translucent panels come out the same as when drawn
+// straight onto the frame
+void RasterizeHud(void) {
+    BeginTextureMode(hud);
+    ClearBackground(BLANK);
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA,
+                              RL_ONE_MINUS_SRC_ALPHA,
+                              RL_ONE,
+                              RL_ONE_MINUS_SRC_ALPHA,
+                              RL_FUNC_ADD,
+                              RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+    DrawHud();
+    EndBlendMode();
+    EndTextureMode();
+}
+
+void Draw(const RenderState *rs) {
+    // the published tick is up to one tick old: carry everything forward along its velocity
+    const float lead = Clamp((ClockNow() - rs->time) / SIM_DT, 0, 1) * SIM_DT * TIMESCALE;
+    // outside BeginDrawing, texture mode would flush the frame's batch
+    if (hud_dirty) {
+        if (b_hud_cached) {
+            RasterizeHud();
+        }
+        hud_dirty = false;
+    }
+    // the part of the world in the window; anything wholly outside it isn't drawn
+    const Vector2 view_min = GetScreenToWorld2D(Vector2Zero(), camera),
+                  view_max = GetScreenToWorld2D((Vector2){SCREEN_WIDTH, SCREEN_HEIGHT}, camera);
+    const Rectangle view = {view_min.x,
+                            view_min.y,
+                            view_max.x - view_min.x,
+                            view_max.y - view_min.y};
+    BeginDrawing();
+    if (!b_solitaire) {
+        ClearBackground(CLITERAL(Color){0x22, 0x22, 0x22, 0xFF});
+    }
+    BeginMode2D(camera);
+    DrawRectangleLinesEx((Rectangle){0, 0, rs->world_width, rs->world_height}, 4.f, GRAY);
+    for (size_t i = 0; i < rs->num_barriers; ++i) {
+        if (CheckCollisionRecs(rs->barriers[i], view)) {
+            DrawRectangleRec(rs->barriers[i], barrierColor);
+            DrawRectangleLinesEx(rs->barriers[i], 4.f, BLACK);
+        }
+    }
+
+    if (b_batched) {
+        ParticleBatchDraw(rs, lead, !b_solitaire, view);
+    } else {
+        for (size_t i = 0; i < rs->count; i++) {
+            if (CheckCollisionRecs((Rectangle){rs->x[i], rs->y[i], rs->size[i], rs->size[i]},
+                                   view)) {
+                DrawParticle(rs, i, lead);
+            }
+        }
+    }
+    for (size_t k = 0; k < rs->num_emitters; k++) {
+        const EmitterState *es = &rs->emitters[k];
+        const Vector2 pos = Vector2Add(es->pos, Vector2Scale(es->velocity, lead));
+        if (CheckCollisionRecs((Rectangle){pos.x, pos.y, es->size, es->size}, view)) {
+            DrawBox(pos, es->size, es->color);
+        }
+    }
+    EndMode2D();
+    if (b_hud_cached) {
+        // render textures are stored bottom-up
+        BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+        DrawTextureRec(hud.texture,
+                       (Rectangle){0, 0, hud.texture.width, -hud.texture.height},
+                       Vector2Zero(),
+                       WHITE);
+        EndBlendMode();
+    } else {
+        DrawHud();
+    }
+    // the frame as shown, HUD and all
+    CaptureFrame();
 
     EndDrawing();
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    const SimConfig config = SimConfigFromArgs(argc, argv);
+    if (!SimInit(&config)) {
+        return 1;
+    }
+
     SetConfigFlags(FLAG_FULLSCREEN_MODE);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, WINDOW_TITLE);
     SetExitKey(KEY_END);
     SetTargetFPS(500);
+    camera = (Camera2D){.offset = (Vector2){SCREEN_WIDTH / 2.f, SCREEN_HEIGHT / 2.f},
+                        .target = (Vector2){world_width / 2.f, world_height / 2.f},
+                        .zoom = 1.f};
+    b_batched = ParticleBatchInit(config.capacity * config.emitters);
+    // without a render texture the HUD is drawn straight onto every frame
+    hud = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+    b_hud_cached = hud.id != 0;
+    capture_format = config.capture_png ? CAPTURE_PNG : CAPTURE_Y4M;
     b_gravity = true;
     b_brownian = true;
     b_nwtn3rd = true;
 
+    // seeded from the bits of the start time
+    const double t = GetTime();
+    uint64_t seed;
+    memcpy(&seed, &t, sizeof(seed));
+    SimSeed(seed);
+
     generateRandomBarriers();
 
-    double t = GetTime();
-    SetRandomSeed(*(unsigned long *) &t);
+    // the simulation runs at a fixed SIM_HZ on its own thread from here on
+    if ((config.replay && !ReplayStart(config.replay)) || !SimThreadStart()) {
+        if (b_batched) {
+            ParticleBatchUnload();
+        }
+        if (b_hud_cached) {
+            UnloadRenderTexture(hud);
+        }
+        CloseWindow();
+        SimShutdown();
+        return 1;
+    }
 
     while (!WindowShouldClose()) {
-        float deltaTime = GetFrameTime() * TIMESCALE;
+        const double frame_start = ClockNow();
+        const RenderState *rs = SimThreadAcquire();
         //handle keyb/mouse input
-        HandleInput(&e);
-        // create new particle if it's time
-        if (++frames % PARTICLE_INTERVAL == 0
-            && (!b_nwtn3rd || b_rocket[0] || b_rocket[1] || b_rocket[2] || b_rocket[3])) {
-            emitParticle(&e);
-        }
-        // update emitter position
-        UpdateBoxPosition((Box *) &e, deltaTime);
-        // update particle positions
-        if (b_repulsion && e.count > 1)
-            DoBoxRepulsion();
-        for (size_t i = 0; i < e.count; i++) {
-            UpdateBoxPosition(&e.particles[i], deltaTime);
-            if (frames % PARTICLE_INTERVAL == 0
-                && (!b_nwtn3rd || b_rocket[0] || b_rocket[1] || b_rocket[2] || b_rocket[3])) {
-                UpdateParticle(&e.particles[i]);
-            }
-        }
+        HandleInput(rs);
+        double t = ProfLap(PROF_INPUT, frame_start);
 
-        DoTextStuff(&e);
+        DoTextStuff(rs);
+        if (b_menuopen && b_profile && render_frames % AVG_KEEP == 0) {
+            UpdateProfilerStats();
+        }
+        t = ProfLap(PROF_TEXT, t);
 
-        Draw(&e);
+        Draw(rs);
+        // EndDrawing waits out the frame limiter, so draw includes the vsync / target-FPS wait
+        ProfLap(PROF_DRAW, t);
+        ProfLap(PROF_FRAME, frame_start);
+        ProfCommit(PROF_RENDER);
+        render_frames++;
     }
 
+    SimThreadStop();
+    // the read-backs still in flight need the GL context
+    CaptureStop();
+    if (config.profile_csv && !ProfWriteCsv(config.profile_csv)) {
+        fprintf(stderr, "could not write profile to '%s'\n", config.profile_csv);
+    }
+    SimShutdown();
+    if (b_batched) {
+        ParticleBatchUnload();
+    }
+    if (b_hud_cached) {
+        UnloadRenderTexture(hud);
+    }
     CloseWindow();
 
     return 0;
@@ -0,0 +1,115 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_WORKERS 256
+
+static pthread_t workers[MAX_WORKERS];
+static size_t nworkers = 1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER, done = PTHREAD_COND_INITIALIZER;
+// bumped once per dispatched job; workers sleep until it moves past the last one they ran
+static size_t generation = 0, running = 0;
+static PoolJob job_fn;
+static void *job_arg;
+static bool quitting = false;
+
+static size_t DetectCores(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t) n : 1;
+#endif
+}
+
+static void *WorkerMain(void *arg) {
+    const size_t id = (size_t) arg;
+    size_t seen = 0;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (generation == seen && !quitting) {
+            pthread_cond_wait(&start, &lock);
+        }
+        if (quitting) {
+            break;
+        }
+        seen = generation;
+        const PoolJob fn = job_fn;
+        void *const fn_arg = job_arg;
+        pthread_mutex_unlock(&lock);
+
+        fn(id, nworkers, fn_arg);
+
+        pthread_mutex_lock(&lock);
+        if (--running == 0) {
+            pthread_cond_signal(&done);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void PoolInit(size_t nthreads) {
+    if (nthreads == 0) {
+        nthreads = DetectCores();
+    }
+    if (nthreads > MAX_WORKERS) {
+        nthreads = MAX_WORKERS;
+    }
+    nworkers = 1;
+    for (size_t i = 1; i < nthreads; i++) {
+        if (pthread_create(&workers[i], NULL, WorkerMain, (void *) i) != 0) {
+            break;
+        }
+        nworkers++;
+    }
+}
+
+void PoolShutdown(void) {
+    pthread_mutex_lock(&lock);
+    quitting = true;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 1; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    nworkers = 1;
+    quitting = false;
+    // workers of the next PoolInit start from seen = 0 and must not rerun the last job
+    generation = 0;
+}
+
+size_t PoolSize(void) {
+    return nworkers;
+}
+
+void PoolRun(PoolJob job, void *arg) {
+    if (nworkers == 1) {
+        job(0, 1, arg);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    job_fn = job;
+    job_arg = arg;
+    running = nworkers - 1;
+    generation++;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+
+    job(0, nworkers, arg);
+
+    pthread_mutex_lock(&lock);
+    while (running > 0) {
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// a job is run once on every worker; worker is in [0, nworkers)
+typedef void (*PoolJob)(size_t worker, size_t nworkers, void *arg);
+
+// start nthreads - 1 long-lived workers (the caller is worker 0); 0 = one per core
+void PoolInit(size_t nthreads);
+void PoolShutdown(void);
+size_t PoolSize(void);
+// run job on every worker and wait until all of them have returned
+void PoolRun(PoolJob job, void *arg);
+
+// split [0, n) evenly across workers, returning this worker's [*first, *last)
+static inline void PoolSplit(size_t n, size_t worker, size_t nworkers, size_t *first, size_t *last) {
+    *first = n * worker / nworkers;
+    *last = n * (worker + 1) / nworkers;
+}
+
+// the same, in whole blocks of align: every boundary but n itself is a multiple of align
+static inline void PoolSplitAligned(size_t n, size_t align, size_t worker, size_t nworkers,
+                                    size_t *first, size_t *last) {
+    PoolSplit((n + align - 1) / align, worker, nworkers, first, last);
+    *first = *first * align < n ? *first * align : n;
+    *last = *last * align < n ? *last * align : n;
+}
+
+#endif
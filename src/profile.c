@@ -0,0 +1,146 @@
+#include "profile.h"
+#include "clock.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// readers leave this many of the oldest slots alone, the writer may be refilling them
+#define PROF_GUARD (PROF_SAMPLES / 16)
+
+static const char *STAGE_NAMES[PROF_STAGES] =
+    {"input", "text", "draw", "frame", "emit", "repulsion", "integrate", "publish"};
+static const ProfDomain STAGE_DOMAINS[PROF_STAGES] =
+    {PROF_RENDER, PROF_RENDER, PROF_RENDER, PROF_RENDER, PROF_SIM, PROF_SIM, PROF_SIM, PROF_SIM};
+static const char *DOMAIN_NAMES[PROF_DOMAINS] = {"render", "sim"};
+
+typedef struct {
+    float stages[PROF_STAGES];
+    float busy[PROF_MAX_WORKERS];
+} ProfSample;
+
+// single-writer ring: the domain's thread fills pending, copies it into the next slot and
+// then publishes the slot by bumping head
+typedef struct {
+    ProfSample pending;
+    ProfSample samples[PROF_SAMPLES];
+    atomic_size_t head;
+} ProfRing;
+
+static ProfRing rings[PROF_DOMAINS];
+static atomic_size_t workers_seen;
+
+const char *ProfStageName(const ProfStage stage) {
+    return STAGE_NAMES[stage];
+}
+
+void ProfAdd(const ProfStage stage, const double seconds) {
+    rings[STAGE_DOMAINS[stage]].pending.stages[stage] += seconds;
+}
+
+double ProfLap(const ProfStage stage, const double since) {
+    const double now = ClockNow();
+    ProfAdd(stage, now - since);
+    return now;
+}
+
+void ProfWorkerBusy(const size_t worker, const double seconds) {
+    if (worker < PROF_MAX_WORKERS) {
+        // each worker owns its slot, and PoolRun orders the writes before the commit
+        rings[PROF_SIM].pending.busy[worker] += seconds;
+        size_t seen = atomic_load_explicit(&workers_seen, memory_order_relaxed);
+        while (worker >= seen
+               && !atomic_compare_exchange_weak_explicit(&workers_seen,
+                                                         &seen,
+                                                         worker + 1,
+                                                         memory_order_relaxed,
+                                                         memory_order_relaxed)) {
+        }
+    }
+}
+
+void ProfCommit(const ProfDomain domain) {
+    ProfRing *ring = &rings[domain];
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->samples[head % PROF_SAMPLES] = ring->pending;
+    memset(&ring->pending, 0, sizeof(ring->pending));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// the readable window of a ring: samples [*first, head), minus guard of the oldest ones
+static size_t Window(const ProfRing *ring, const size_t guard, size_t *first) {
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    *first = head > PROF_SAMPLES - guard ? head - (PROF_SAMPLES - guard) : 0;
+    return head;
+}
+
+static int CompareFloat(const void *a, const void *b) {
+    const float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+size_t ProfPercentiles(const ProfStage stage, double *p50, double *p99) {
+    static float values[PROF_SAMPLES];
+    const ProfRing *ring = &rings[STAGE_DOMAINS[stage]];
+    size_t first;
+    const size_t head = Window(ring, PROF_GUARD, &first), n = head - first;
+    if (n == 0) {
+        *p50 = *p99 = 0;
+        return 0;
+    }
+    for (size_t s = first; s < head; s++) {
+        values[s - first] = ring->samples[s % PROF_SAMPLES].stages[stage];
+    }
+    qsort(values, n, sizeof(*values), CompareFloat);
+    *p50 = values[n / 2];
+    *p99 = values[n * 99 / 100];
+    return n;
+}
+
+size_t ProfWorkers(void) {
+    return atomic_load_explicit(&workers_seen, memory_order_relaxed);
+}
+
+double ProfWorkerMean(const size_t worker) {
+    const ProfRing *ring = &rings[PROF_SIM];
+    size_t first;
+    const size_t head = Window(ring, PROF_GUARD, &first);
+    double sum = 0;
+    for (size_t s = first; s < head; s++) {
+        sum += ring->samples[s % PROF_SAMPLES].busy[worker];
+    }
+    return head > first ? sum / (head - first) : 0;
+}
+
+bool ProfWriteCsv(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "domain,sample,stage,ms\n");
+    for (int d = 0; d < PROF_DOMAINS; d++) {
+        const ProfRing *ring = &rings[d];
+        size_t first;
+        // meant for after the writers have stopped, so the whole ring is readable
+        const size_t head = Window(ring, 0, &first);
+        for (size_t s = first; s < head; s++) {
+            const ProfSample *sample = &ring->samples[s % PROF_SAMPLES];
+            for (int stage = 0; stage < PROF_STAGES; stage++) {
+                if (STAGE_DOMAINS[stage] == (ProfDomain) d) {
+                    fprintf(f,
+                            "%s,%zu,%s,%.4f\n",
+                            DOMAIN_NAMES[d],
+                            s,
+                            STAGE_NAMES[stage],
+                            sample->stages[stage] * 1e3);
+                }
+            }
+            if (d == PROF_SIM) {
+                for (size_t w = 0; w < ProfWorkers(); w++) {
+                    fprintf(f, "sim,%zu,worker%zu,%.4f\n", s, w, sample->busy[w] * 1e3);
+                }
+            }
+        }
+    }
+    return fclose(f) == 0;
+}
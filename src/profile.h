@@ -0,0 +1,46 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// per-frame (render thread) and per-tick (sim thread) samples, each written by its own thread
+typedef enum { PROF_RENDER, PROF_SIM, PROF_DOMAINS } ProfDomain;
+
+typedef enum {
+    // render thread
+    PROF_INPUT,
+    PROF_TEXT,
+    PROF_DRAW,
+    PROF_FRAME,
+    // sim thread
+    PROF_EMIT,      // emission and emitter motion
+    PROF_REPULSION,
+    PROF_INTEGRATE,
+    PROF_PUBLISH,
+    PROF_STAGES
+} ProfStage;
+
+#define PROF_SAMPLES 4096
+#define PROF_MAX_WORKERS 64
+
+const char *ProfStageName(ProfStage stage);
+// add seconds to stage in the sample its domain's thread is building
+void ProfAdd(ProfStage stage, double seconds);
+// ProfAdd the time since `since` (a ClockNow reading) and return the current time
+double ProfLap(ProfStage stage, double since);
+// time a repulsion worker spent busy this tick; called from inside its pool job
+void ProfWorkerBusy(size_t worker, double seconds);
+// close the current sample of the calling thread's domain and publish it to readers
+void ProfCommit(ProfDomain domain);
+
+// over the samples in the ring: median and 99th percentile of a stage, in seconds,
+// and how many samples that was
+size_t ProfPercentiles(ProfStage stage, double *p50, double *p99);
+// workers that have reported busy time, and the mean busy time of one per tick
+size_t ProfWorkers(void);
+double ProfWorkerMean(size_t worker);
+// every sample in the rings as domain,sample,stage,ms rows; call once the writers have stopped
+bool ProfWriteCsv(const char *path);
+
+#endif
@@ -0,0 +1,188 @@
+#include "quadtree.h"
+#include <stdlib.h>
+
+// boxes a node may hold before it is split
+#define QUAD_LEAF 8
+// bits of each axis in a key
+#define QUAD_BITS 16
+
+#define min(a, b) ((a) > (b) ? (b) : (a))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define quadrant(KEY, SHIFT) (((KEY) >> (SHIFT)) & 3)
+
+QuadNode *quad_nodes;
+QuadBox *quad_boxes;
+size_t num_quad_nodes;
+
+// key << 32 | index, sorted on the key
+static uint64_t *keys, *sort_scratch;
+static size_t capacity;
+
+static bool Reserve(const size_t n) {
+    if (n <= capacity) {
+        return true;
+    }
+    // an inner node splits into at least two, so there are fewer inner nodes than leaves
+    QuadNode *nodes = malloc(2 * n * sizeof(*nodes));
+    QuadBox *boxes = malloc(n * sizeof(*boxes));
+    uint64_t *k = malloc(2 * n * sizeof(*k));
+    if (!nodes || !boxes || !k) {
+        free(nodes);
+        free(boxes);
+        free(k);
+        return false;
+    }
+    QuadtreeFree();
+    quad_nodes = nodes;
+    quad_boxes = boxes;
+    keys = k;
+    sort_scratch = k + n;
+    capacity = n;
+    return true;
+}
+
+// the bits of v spread out to the even bit positions
+static inline uint32_t Spread(uint32_t v) {
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+// stable LSD radix sort of keys[0 .. n) on their upper 32 bits, a byte at a time
+static void SortKeys(const size_t n) {
+    uint64_t *from = keys, *to = sort_scratch;
+    for (int shift = 32; shift < 64; shift += 8) {
+        size_t offsets[257] = {0};
+        for (size_t i = 0; i < n; i++) {
+            offsets[((from[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            offsets[b + 1] += offsets[b];
+        }
+        for (size_t i = 0; i < n; i++) {
+            to[offsets[(from[i] >> shift) & 0xFF]++] = from[i];
+        }
+        uint64_t *swap = from;
+        from = to;
+        to = swap;
+    }
+    // an even number of passes leaves the result back in keys
+}
+
+// first box in [lo, hi) whose quadrant at shift is past q; the run is sorted on it
+static size_t QuadrantEnd(size_t lo, size_t hi, const int shift, const uint32_t q) {
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (quadrant((uint32_t) (keys[mid] >> 32), shift) <= q) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// the node over boxes [lo, hi), whose keys agree above shift + 2, and its subtree
+static void Build(const size_t lo, const size_t hi, int shift) {
+    // levels where every box falls in the same quadrant would be nodes with one child
+    while (shift >= 0 && hi - lo > QUAD_LEAF
+           && quadrant((uint32_t) (keys[lo] >> 32), shift)
+                  == quadrant((uint32_t) (keys[hi - 1] >> 32), shift)) {
+        shift -= 2;
+    }
+    const size_t n = num_quad_nodes++;
+    QuadNode node = {.x0 = quad_boxes[lo].cx,
+                     .y0 = quad_boxes[lo].cy,
+                     .x1 = quad_boxes[lo].cx,
+                     .y1 = quad_boxes[lo].cy,
+                     .first = lo,
+                     .count = hi - lo,
+                     .leaf = shift < 0 || hi - lo <= QUAD_LEAF};
+    float wx = 0, wy = 0;
+    if (node.leaf) {
+        for (size_t i = lo; i < hi; i++) {
+            const QuadBox *b = &quad_boxes[i];
+            node.x0 = min(node.x0, b->cx);
+            node.y0 = min(node.y0, b->cy);
+            node.x1 = max(node.x1, b->cx);
+            node.y1 = max(node.y1, b->cy);
+            node.weight += b->size;
+            node.weight4 += b->size * b->size * b->size * b->size;
+            node.max_size = max(node.max_size, b->size);
+            wx += b->cx * b->size;
+            wy += b->cy * b->size;
+        }
+    } else {
+        size_t start = lo;
+        for (uint32_t q = 0; q < 4; q++) {
+            const size_t end = QuadrantEnd(start, hi, shift, q);
+            if (start == end) {
+                continue;
+            }
+            const size_t c = num_quad_nodes;
+            Build(start, end, shift - 2);
+            const QuadNode *child = &quad_nodes[c];
+            node.x0 = min(node.x0, child->x0);
+            node.y0 = min(node.y0, child->y0);
+            node.x1 = max(node.x1, child->x1);
+            node.y1 = max(node.y1, child->y1);
+            node.weight += child->weight;
+            node.weight4 += child->weight4;
+            node.max_size = max(node.max_size, child->max_size);
+            wx += child->cx * child->weight;
+            wy += child->cy * child->weight;
+            start = end;
+        }
+    }
+    node.cx = wx / node.weight;
+    node.cy = wy / node.weight;
+    node.skip = num_quad_nodes;
+    quad_nodes[n] = node;
+}
+
+bool QuadtreeBuild(const float *x, const float *y, const float *size, const size_t n) {
+    num_quad_nodes = 0;
+    if (n == 0) {
+        return true;
+    }
+    if (!Reserve(n)) {
+        return false;
+    }
+    float x0 = x[0] + size[0] / 2.f, y0 = y[0] + size[0] / 2.f, x1 = x0, y1 = y0;
+    for (size_t i = 1; i < n; i++) {
+        const float cx = x[i] + size[i] / 2.f, cy = y[i] + size[i] / 2.f;
+        x0 = min(x0, cx);
+        y0 = min(y0, cy);
+        x1 = max(x1, cx);
+        y1 = max(y1, cy);
+    }
+    // one square over all of them, so each level halves both sides
+    const float side = max(x1 - x0, y1 - y0);
+    const float scale = side > 0 ? ((1u << QUAD_BITS) - 1) / side : 0;
+    for (size_t i = 0; i < n; i++) {
+        const float cx = x[i] + size[i] / 2.f, cy = y[i] + size[i] / 2.f;
+        const uint32_t qx = min((uint32_t) ((cx - x0) * scale), (1u << QUAD_BITS) - 1),
+                       qy = min((uint32_t) ((cy - y0) * scale), (1u << QUAD_BITS) - 1);
+        keys[i] = (uint64_t) (Spread(qx) | Spread(qy) << 1) << 32 | i;
+    }
+    SortKeys(n);
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t j = (uint32_t) keys[i];
+        quad_boxes[i] = (QuadBox){x[j] + size[j] / 2.f, y[j] + size[j] / 2.f, size[j], j};
+    }
+    Build(0, n, 2 * QUAD_BITS - 2);
+    return true;
+}
+
+void QuadtreeFree(void) {
+    free(quad_nodes);
+    free(quad_boxes);
+    free(keys);
+    quad_nodes = NULL;
+    quad_boxes = NULL;
+    keys = sort_scratch = NULL;
+    num_quad_nodes = 0;
+    capacity = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Barnes-Hut quadtree over square boxes, rebuilt from scratch with QuadtreeBuild. Boxes are
+// sorted by the Z-order key of their centres and the nodes laid out in preorder, so a
+// subtree is one run of nodes ending at skip and one run of boxes.
+
+// a box in tree order: its centre, side and the index it was given at
+typedef struct {
+    float cx, cy, size;
+    uint32_t index;
+} QuadBox;
+
+typedef struct {
+    float x0, y0, x1, y1; // bounds of the centres below
+    float cx, cy;         // centre of the boxes below, weighted by size
+    float weight;         // sum of their sizes
+    float weight4;        // sum of their sizes to the fourth
+    float max_size;
+    uint32_t first, count; // quad_boxes[first .. first + count)
+    uint32_t skip;         // the node after this subtree
+    bool leaf;             // the boxes are visited one by one rather than through children
+} QuadNode;
+
+extern QuadNode *quad_nodes;
+extern QuadBox *quad_boxes;
+extern size_t num_quad_nodes;
+
+// build the tree over n boxes with top-left corners (x[i], y[i]) and sides size[i]
+bool QuadtreeBuild(const float *x, const float *y, const float *size, size_t n);
+void QuadtreeFree(void);
+
+#endif
@@ -0,0 +1,164 @@
+#include "render.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OUTLINE_WIDTH 2.f
+
+// per-particle instance data; the quad corners come from a shared 6-vertex buffer
+typedef struct {
+    float x, y, size;
+    Color color;
+} Instance;
+
+// the outline is done per fragment from the distance to the quad's nearest edge
+static const char *VERTEX_SHADER = "in vec2 vertexPosition;\n"
+                                   "in vec3 instanceBox;\n"
+                                   "in vec4 vertexColor;\n"
+                                   "uniform mat4 mvp;\n"
+                                   "out vec2 local;\n"
+                                   "flat out float size;\n"
+                                   "flat out vec4 color;\n"
+                                   "void main() {\n"
+                                   "    size = instanceBox.z;\n"
+                                   "    local = vertexPosition * size;\n"
+                                   "    color = vertexColor;\n"
+                                   "    gl_Position = mvp * vec4(instanceBox.xy + local, 0.0, 1.0);\n"
+                                   "}\n";
+
+static const char *FRAGMENT_SHADER = "in vec2 local;\n"
+                                     "flat in float size;\n"
+                                     "flat in vec4 color;\n"
+                                     "uniform float outline;\n"
+                                     "out vec4 finalColor;\n"
+                                     "void main() {\n"
+                                     "    vec2 edge = min(local, vec2(size) - local);\n"
+                                     "    finalColor = min(edge.x, edge.y) < outline\n"
+                                     "        ? vec4(0.0, 0.0, 0.0, 1.0) : color;\n"
+                                     "}\n";
+
+static Shader shader;
+static int loc_box, loc_color, loc_outline;
+static unsigned int vao, corners_vbo, instances_vbo;
+static Instance *instances;
+static size_t instances_capacity;
+
+// (re)create the per-instance buffer inside the vertex array
+static bool LoadInstances(const size_t capacity) {
+    Instance *grown = realloc(instances, capacity * sizeof(*instances));
+    if (!grown) {
+        return false;
+    }
+    instances = grown;
+    instances_capacity = capacity;
+    rlEnableVertexArray(vao);
+    if (instances_vbo) {
+        rlUnloadVertexBuffer(instances_vbo);
+    }
+    instances_vbo = rlLoadVertexBuffer(NULL, capacity * sizeof(*instances), true);
+    rlSetVertexAttribute(loc_box, 3, RL_FLOAT, false, sizeof(Instance), offsetof(Instance, x));
+    rlSetVertexAttributeDivisor(loc_box, 1);
+    rlEnableVertexAttribute(loc_box);
+    rlSetVertexAttribute(loc_color,
+                         4,
+                         RL_UNSIGNED_BYTE,
+                         true,
+                         sizeof(Instance),
+                         offsetof(Instance, color));
+    rlSetVertexAttributeDivisor(loc_color, 1);
+    rlEnableVertexAttribute(loc_color);
+    rlDisableVertexArray();
+    return true;
+}
+
+bool ParticleBatchInit(const size_t capacity) {
+    const char *header;
+    switch (rlGetVersion()) {
+    case RL_OPENGL_33:
+    case RL_OPENGL_43:
+        header = "#version 330\n";
+        break;
+    case RL_OPENGL_ES_30:
+        header = "#version 300 es\nprecision highp float;\n";
+        break;
+    default:
+        // GL 1.1/2.1 and GLES2 have no core instancing
+        return false;
+    }
+    static char vs[1024], fs[1024];
+    snprintf(vs, sizeof(vs), "%s%s", header, VERTEX_SHADER);
+    snprintf(fs, sizeof(fs), "%s%s", header, FRAGMENT_SHADER);
+    shader = LoadShaderFromMemory(vs, fs);
+    if (shader.id == rlGetShaderIdDefault()) {
+        return false;
+    }
+    loc_box = GetShaderLocationAttrib(shader, "instanceBox");
+    loc_color = shader.locs[SHADER_LOC_VERTEX_COLOR];
+    loc_outline = GetShaderLocation(shader, "outline");
+
+    static const float corners[] = {0, 0, 0, 1, 1, 1, 0, 0, 1, 1, 1, 0};
+    vao = rlLoadVertexArray();
+    rlEnableVertexArray(vao);
+    corners_vbo = rlLoadVertexBuffer(corners, sizeof(corners), false);
+    rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION], 2, RL_FLOAT, false, 0, 0);
+    rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION]);
+    rlDisableVertexArray();
+    if (!LoadInstances(max(capacity, 1))) {
+        ParticleBatchUnload();
+        return false;
+    }
+    return true;
+}
+
+void ParticleBatchUnload(void) {
+    rlUnloadVertexArray(vao);
+    rlUnloadVertexBuffer(corners_vbo);
+    rlUnloadVertexBuffer(instances_vbo);
+    UnloadShader(shader);
+    free(instances);
+    instances = NULL;
+    instances_vbo = 0;
+    instances_capacity = 0;
+}
+
+void ParticleBatchDraw(const RenderState *rs,
+                       const float lead,
+                       const bool outlines,
+                       const Rectangle view) {
+    if (rs->count > instances_capacity && !LoadInstances(rs->capacity)) {
+        return;
+    }
+    // emitter by emitter and oldest first within each, as published, so overlaps stack the way
+    // they always have; culled against the view on the way, one compare per side
+    const float x0 = view.x, y0 = view.y, x1 = view.x + view.width, y1 = view.y + view.height;
+    size_t n = 0;
+    for (size_t i = 0; i < rs->count; i++) {
+        const float x = rs->x[i] + rs->vx[i] * lead, y = rs->y[i] + rs->vy[i] * lead,
+                    size = rs->size[i];
+        if (x + size >= x0 && x <= x1 && y + size >= y0 && y <= y1) {
+            instances[n++] = (Instance){x, y, size, palette_color(rs->age[i])};
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    // flush what raylib has batched so far so the barriers stay underneath
+    rlDrawRenderBatchActive();
+    rlUpdateVertexBuffer(instances_vbo, instances, n * sizeof(*instances), 0);
+    rlEnableShader(shader.id);
+    const Matrix mvp = MatrixMultiply(MatrixMultiply(rlGetMatrixTransform(),
+                                                     rlGetMatrixModelview()),
+                                      rlGetMatrixProjection());
+    rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], mvp);
+    const float outline = outlines ? OUTLINE_WIDTH : 0;
+    rlSetUniform(loc_outline, &outline, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlDisableBackfaceCulling();
+    rlEnableVertexArray(vao);
+    rlDrawVertexArrayInstanced(0, 6, n);
+    rlDisableVertexArray();
+    rlEnableBackfaceCulling();
+    rlDisableShader();
+}
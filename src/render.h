@@ -0,0 +1,14 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "simthread.h"
+
+// one instanced draw call for all live particles; false if the GL context can't do it
+// (no instancing, or the shader failed to build) and Draw should fall back to DrawBox
+bool ParticleBatchInit(size_t capacity);
+void ParticleBatchUnload(void);
+// particles oldest first, each carried lead seconds forward along its velocity; those wholly
+// outside view aren't sent to the GPU
+void ParticleBatchDraw(const RenderState *rs, float lead, bool outlines, Rectangle view);
+
+#endif
@@ -0,0 +1,132 @@
+#include "rng.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+#define GOLDEN 0x9E3779B9u
+
+// lowbias32 finalizer, a full-avalanche 32-bit mix
+static inline uint32_t Mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t RngKey(uint64_t seed, uint64_t frame, RngStream stream) {
+    uint32_t k = Mix32((uint32_t) seed ^ Mix32((uint32_t) (seed >> 32) + GOLDEN));
+    k = Mix32(k ^ (uint32_t) frame);
+    k = Mix32(k ^ (uint32_t) (frame >> 32) ^ Mix32((uint32_t) stream + GOLDEN));
+    return k;
+}
+
+// the top 24 bits as a float in [0, 1), scaled to a bucket in [0, 2 * half] and recentred
+float RngSigned(uint32_t key, uint32_t counter, int half) {
+    const float u = (float) (Mix32(key + counter * GOLDEN) >> 8) * (1.f / (1 << 24));
+    return ((float) (int) (u * (float) (2 * half + 1)) - (float) half) * (1.f / (float) half);
+}
+
+int RngRange(uint32_t key, uint32_t counter, int lo, int hi) {
+    const double u = (double) (Mix32(key + counter * GOLDEN) >> 8) * (1. / (1 << 24));
+    return lo + (int) (u * ((double) hi - lo + 1));
+}
+
+static void FillScalar(uint32_t key, uint32_t first, int half, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = RngSigned(key, first + (uint32_t) i, half);
+    }
+}
+
+#if defined(__SSE2__)
+
+// sse2 has no 32-bit mullo, so multiply the even and odd lanes separately
+static inline __m128i MulLo32(__m128i a, __m128i b) {
+    const __m128i even = _mm_mul_epu32(a, b),
+                  odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void FillSSE2(uint32_t key, uint32_t first, int half, float *out, size_t n) {
+    const __m128i m1 = _mm_set1_epi32(0x7feb352d), m2 = _mm_set1_epi32((int) 0x846ca68bu),
+                  golden = _mm_set1_epi32((int) GOLDEN), step = _mm_set1_epi32((int) (4 * GOLDEN));
+    const __m128 unit = _mm_set1_ps(1.f / (1 << 24)), buckets = _mm_set1_ps((float) (2 * half + 1)),
+                 offset = _mm_set1_ps((float) half), scale = _mm_set1_ps(1.f / (float) half);
+    __m128i x = _mm_add_epi32(_mm_set1_epi32((int) key),
+                              MulLo32(_mm_add_epi32(_mm_set1_epi32((int) first),
+                                                    _mm_setr_epi32(0, 1, 2, 3)),
+                                      golden));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, x = _mm_add_epi32(x, step)) {
+        __m128i h = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+        h = MulLo32(h, m1);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+        h = MulLo32(h, m2);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+        const __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), unit);
+        const __m128 k = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(u, buckets)));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_sub_ps(k, offset), scale));
+    }
+    FillScalar(key, first + (uint32_t) i, half, out + i, n - i);
+}
+
+#endif
+
+#if HAVE_AVX2_KERNELS
+
+__attribute__((target("avx2"))) static void FillAVX2(uint32_t key, uint32_t first, int half,
+                                                     float *out, size_t n) {
+    const __m256i m1 = _mm256_set1_epi32(0x7feb352d), m2 = _mm256_set1_epi32((int) 0x846ca68bu),
+                  golden = _mm256_set1_epi32((int) GOLDEN),
+                  step = _mm256_set1_epi32((int) (8 * GOLDEN));
+    const __m256 unit = _mm256_set1_ps(1.f / (1 << 24)),
+                 buckets = _mm256_set1_ps((float) (2 * half + 1)),
+                 offset = _mm256_set1_ps((float) half), scale = _mm256_set1_ps(1.f / (float) half);
+    __m256i x = _mm256_add_epi32(
+        _mm256_set1_epi32((int) key),
+        _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32((int) first),
+                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)),
+                           golden));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, x = _mm256_add_epi32(x, step)) {
+        __m256i h = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+        h = _mm256_mullo_epi32(h, m1);
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+        h = _mm256_mullo_epi32(h, m2);
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+        const __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h, 8)), unit);
+        const __m256 k = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_mul_ps(u, buckets)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_sub_ps(k, offset), scale));
+    }
+    FillScalar(key, first + (uint32_t) i, half, out + i, n - i);
+}
+
+#endif
+
+typedef void (*FillKernel)(uint32_t, uint32_t, int, float *, size_t);
+
+#if defined(__SSE2__)
+static FillKernel fill_kernel = FillSSE2;
+#else
+static FillKernel fill_kernel = FillScalar;
+#endif
+
+void RngInit(void) {
+#if HAVE_AVX2_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fill_kernel = FillAVX2;
+    }
+#endif
+}
+
+void RngFillSigned(uint32_t key, uint32_t first, int half, float *out, size_t n) {
+    fill_kernel(key, first, half, out, n);
+}
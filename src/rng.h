@@ -0,0 +1,29 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// counter-based generator: a value depends only on (key, counter), never on call order,
+// so any thread can draw the numbers for any particle and still reproduce a run
+typedef enum {
+    RNG_BROWNIAN_X,
+    RNG_BROWNIAN_Y,
+    RNG_EMIT_X,
+    RNG_EMIT_Y,
+    RNG_BARRIERS,
+} RngStream;
+
+// pick the widest batch kernel the cpu supports; safe to call more than once
+void RngInit(void);
+
+// key for one stream of one frame of a seeded run
+uint32_t RngKey(uint64_t seed, uint64_t frame, RngStream stream);
+// one of the 2 * half + 1 evenly spaced values k / half, k in [-half, half]
+float RngSigned(uint32_t key, uint32_t counter, int half);
+// an integer in [lo, hi]
+int RngRange(uint32_t key, uint32_t counter, int lo, int hi);
+// out[i] = RngSigned(key, first + i, half), vectorized
+void RngFillSigned(uint32_t key, uint32_t first, int half, float *out, size_t n);
+
+#endif
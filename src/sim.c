@@ -0,0 +1,1462 @@
+#include "sim.h"
+#include "alloc.h"
+#include "clock.h"
+#include "integrate.h"
+#include "pool.h"
+#include "profile.h"
+#include "quadtree.h"
+#include "raymath.h"
+#include "rng.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Emitter emitters[MAX_EMITTERS];
+size_t num_emitters, active_emitter;
+float world_width = SCREEN_WIDTH, world_height = SCREEN_HEIGHT;
+// pool size and backing of every emitter, from the SimConfig
+static size_t emitter_capacity;
+static bool emitter_hugepages;
+
+Color palette[PALETTE_SIZE];
+float palette_start;
+
+//static const Rectangle barrier = (Rectangle) {500, 300, 200, 100};
+Rectangle *barriers;
+size_t num_barriers, max_barriers, barrier_version;
+bool b_gravity, b_brownian, b_nwtn3rd, b_repulsion, b_barnes_hut;
+size_t frames = 0;
+double repulsion_radius = 1.75, repulsion_factor = 2, brown_factor = .25, opening_angle = .5;
+uint64_t sim_seed;
+
+// emitters draw from their own random streams; emitter 0 uses sim_seed itself
+#define emitter_seed(K) (sim_seed + (K) * 0x9E3779B97F4A7C15ull)
+
+void CalcVelocityAfterCollision(Vector2 *velocity, const float size, const Axis a) {
+    double friction = (1 - ((size) / (MAX_ESIZE * 2)));
+    switch (a) {
+    case AXIS_X:
+        velocity->x *= -friction;
+        velocity->y *= friction;
+        break;
+    case AXIS_Y:
+        velocity->y *= -friction;
+        velocity->x *= friction;
+        break;
+    }
+}
+
+#define BARRIER_CELL_SIZE 64
+
+// static grid of barrier indices over the world, rebuilt whenever the barriers change:
+// barriers that can touch a box whose top-left corner lies in cell c are
+// barrier_cells[barrier_cell_start[c] .. barrier_cell_start[c + 1])
+static int barrier_cols, barrier_rows;
+static size_t *barrier_cell_start, *barrier_cell_fill;
+static size_t *barrier_cells;
+
+#define barrier_cell_x(X) min(max((int) floorf((X) / BARRIER_CELL_SIZE), 0), barrier_cols - 1)
+#define barrier_cell_y(Y) min(max((int) floorf((Y) / BARRIER_CELL_SIZE), 0), barrier_rows - 1)
+
+// visit every cell holding a corner from which a box of up to MAX_ESIZE can reach barrier b;
+// the edges extend one pixel past the right and bottom sides
+#define for_barrier_cells(B, CX, CY) \
+    for (int CY = barrier_cell_y((B).y - MAX_ESIZE); CY <= barrier_cell_y((B).y + (B).height + 1); \
+         CY++) \
+        for (int CX = barrier_cell_x((B).x - MAX_ESIZE); \
+             CX <= barrier_cell_x((B).x + (B).width + 1); \
+             CX++)
+
+void BuildBarrierGrid(void) {
+    barrier_version++;
+    const size_t cells = (size_t) barrier_cols * barrier_rows;
+    memset(barrier_cell_start, 0, (cells + 1) * sizeof(*barrier_cell_start));
+    for (size_t i = 0; i < num_barriers; i++) {
+        for_barrier_cells(barriers[i], cx, cy) {
+            barrier_cell_start[cy * barrier_cols + cx + 1]++;
+        }
+    }
+    for (size_t c = 0; c < cells; c++) {
+        barrier_cell_start[c + 1] += barrier_cell_start[c];
+    }
+    free(barrier_cells);
+    barrier_cells = malloc(max(barrier_cell_start[cells], 1) * sizeof(*barrier_cells));
+    memcpy(barrier_cell_fill, barrier_cell_start, cells * sizeof(*barrier_cell_fill));
+    // ascending barrier order within each cell, same as scanning the whole array
+    for (size_t i = 0; i < num_barriers; i++) {
+        for_barrier_cells(barriers[i], cx, cy) {
+            barrier_cells[barrier_cell_fill[cy * barrier_cols + cx]++] = i;
+        }
+    }
+}
+
+// whether a box of side size at `at` overlaps barrier r or its edges
+static inline bool OverlapsBarrier(const Vector2 at, const float size, const Rectangle r) {
+    return at.x > r.x - size && at.x < r.x + r.width + 1 && at.y > r.y - size
+           && at.y < r.y + r.height + 1;
+}
+
+static bool OverlapsBarriers(const Vector2 at, const float size) {
+    const int cell = barrier_cell_y(at.y) * barrier_cols + barrier_cell_x(at.x);
+    for (size_t k = barrier_cell_start[cell]; k < barrier_cell_start[cell + 1]; k++) {
+        if (OverlapsBarrier(at, size, barriers[barrier_cells[k]])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a box of side size at *at that overlaps barrier r goes out through a face, where a sweep
+// would have stopped it: the nearest one that leaves it clear of every barrier, since barriers
+// may touch, or just the nearest if there is none; false if it doesn't overlap r
+static bool PushOutOfBarrier(Vector2 *at, const float size, const Rectangle r) {
+    if (!OverlapsBarrier(*at, size, r)) {
+        return false;
+    }
+    const Vector2 exits[4] = {{r.x - size, at->y},
+                              {r.x + r.width + 1, at->y},
+                              {at->x, r.y - size},
+                              {at->x, r.y + r.height + 1}};
+    float nearest = FLT_MAX, nearest_clear = FLT_MAX;
+    int exit = 0, exit_clear = -1;
+    for (int f = 0; f < 4; f++) {
+        const float dist = fabsf(exits[f].x - at->x) + fabsf(exits[f].y - at->y);
+        if (dist < nearest) {
+            nearest = dist;
+            exit = f;
+        }
+        if (dist < nearest_clear && !OverlapsBarriers(exits[f], size)) {
+            nearest_clear = dist;
+            exit_clear = f;
+        }
+    }
+    *at = exits[exit_clear >= 0 ? exit_clear : exit];
+    return true;
+}
+
+void CollideWithBarriers(Vector2 *pos, Vector2 *velocity, const float size) {
+    const Rectangle cur = (Rectangle){pos->x, pos->y, size, size};
+    const int cell = barrier_cell_y(pos->y) * barrier_cols + barrier_cell_x(pos->x);
+    for (size_t k = barrier_cell_start[cell]; k < barrier_cell_start[cell + 1]; ++k) {
+        const Rectangle barrier = barriers[barrier_cells[k]], top = {barrier.x, barrier.y, barrier.width, 1},
+                        bot = {barrier.x, barrier.y + barrier.height, barrier.width, 1},
+                        left = {barrier.x, barrier.y, 1, barrier.height},
+                        right = {barrier.x + barrier.width, barrier.y, 1, barrier.height},
+                        topCol = GetCollisionRec(cur, top), botCol = GetCollisionRec(cur, bot),
+                        leftCol = GetCollisionRec(cur, left),
+                        rightCol = GetCollisionRec(cur, right);
+        const float vertIsect = max(topCol.width, botCol.width),
+                    horzIsect = max(leftCol.height, rightCol.height);
+        if (vertIsect > horzIsect) {
+            if (topCol.width > 0) {
+                pos->y = top.y - size;
+            } else if (botCol.width > 0) {
+                pos->y = bot.y + 1;
+            }
+            if (topCol.width > 0 || botCol.width > 0) {
+                CalcVelocityAfterCollision(velocity, size, AXIS_Y);
+            }
+        } else {
+            if (leftCol.height > 0) {
+                pos->x = left.x - size;
+            } else if (rightCol.height > 0) {
+                pos->x = right.x + 1;
+            }
+            if (leftCol.height > 0 || rightCol.height > 0) {
+                CalcVelocityAfterCollision(velocity, size, AXIS_X);
+            }
+        }
+    }
+}
+
+// a sweep that keeps hitting barriers gives up after this many bounces and stays at the last
+#define SWEEP_BOUNCES 4
+
+// the times t at which p + d * t lies strictly between lo and hi, as [*t0, *t1]; false if never.
+// Always is -FLT_MAX to FLT_MAX: -Ofast assumes there are no infinities.
+static inline bool SweepSlab(const float p, const float d, const float lo, const float hi,
+                             float *t0, float *t1) {
+    if (d == 0) {
+        *t0 = -FLT_MAX;
+        *t1 = FLT_MAX;
+        return p > lo && p < hi;
+    }
+    const float a = (lo - p) / d, b = (hi - p) / d;
+    *t0 = min(a, b);
+    *t1 = max(a, b);
+    return true;
+}
+
+// the earliest t in [0, 1] at which a box of side size moving from `from` by d starts to
+// overlap the edges of a barrier it wasn't touching, or 2 if none; *hit is that barrier and
+// *axis the axis of the face it meets. Every barrier the box can touch on the way is listed
+// in a cell its corner passes over, so the cells under the move's bounds are enough.
+static float FirstBarrierHit(const Vector2 from, const Vector2 d, const float size, size_t *hit,
+                             Axis *axis) {
+    float first = 2;
+    const int x0 = barrier_cell_x(min(from.x, from.x + d.x)),
+              x1 = barrier_cell_x(max(from.x, from.x + d.x));
+    for (int cy = barrier_cell_y(min(from.y, from.y + d.y));
+         cy <= barrier_cell_y(max(from.y, from.y + d.y));
+         cy++) {
+        for (int cx = x0; cx <= x1; cx++) {
+            const int cell = cy * barrier_cols + cx;
+            for (size_t k = barrier_cell_start[cell]; k < barrier_cell_start[cell + 1]; k++) {
+                // where the corner has to be for the box to overlap the barrier or its edges
+                const Rectangle b = barriers[barrier_cells[k]];
+                float tx0, tx1, ty0, ty1;
+                if (!SweepSlab(from.x, d.x, b.x - size, b.x + b.width + 1, &tx0, &tx1)
+                    || !SweepSlab(from.y, d.y, b.y - size, b.y + b.height + 1, &ty0, &ty1)) {
+                    continue;
+                }
+                const float enter = max(tx0, ty0), leave = min(tx1, ty1);
+                // SweepBarriers pushed it out of any it started in, so this is only touching
+                if (enter >= 0 && enter <= 1 && enter < leave && enter < first) {
+                    first = enter;
+                    *hit = barrier_cells[k];
+                    *axis = tx0 > ty0 ? AXIS_X : AXIS_Y;
+                }
+            }
+        }
+    }
+    return first;
+}
+
+// a box of side size at *at that overlaps barriers, as when they are regenerated over it, goes
+// out of each through the face it is nearest to; false if it overlaps none
+static bool PushOutOfBarriers(Vector2 *at, const float size) {
+    bool moved = false;
+    const int cell = barrier_cell_y(at->y) * barrier_cols + barrier_cell_x(at->x);
+    for (size_t k = barrier_cell_start[cell]; k < barrier_cell_start[cell + 1]; k++) {
+        moved |= PushOutOfBarrier(at, size, barriers[barrier_cells[k]]);
+    }
+    return moved;
+}
+
+// the world's edges stopped a box at pos: bounce it off them as the integrate kernels do
+static inline void BounceOffWalls(const Vector2 pos, Vector2 *velocity, const float size) {
+    const double speed = Vector2Length(*velocity);
+    if (speed > .01 && (pos.x == 1 || pos.x == world_width - size)) {
+        CalcVelocityAfterCollision(velocity, size, AXIS_X);
+    }
+    if (speed > .01 && (pos.y == 1 || pos.y == world_height - size)) {
+        CalcVelocityAfterCollision(velocity, size, AXIS_Y);
+    }
+}
+
+// a box moved from `from` to *pos this step: if the move was long enough to jump clean over
+// a barrier edge, which CollideWithBarriers only looks for at the end, replay it stopping at
+// each barrier face on the way, bouncing off it as CollideWithBarriers would and carrying on
+// for the rest of the step at the new velocity. A box that started inside a barrier is pushed
+// out of it first.
+void SweepBarriers(Vector2 *pos, Vector2 *velocity, const Vector2 from, const float size,
+                   const float deltaTime) {
+    Vector2 at = from, d = Vector2Subtract(*pos, from);
+    // an edge is a pixel thick, crossing it whole takes more than the box's side
+    if (max(fabsf(d.x), fabsf(d.y)) <= size) {
+        return;
+    }
+    if (PushOutOfBarriers(&at, size)) {
+        *pos = Vector2Clamp(Vector2Add(at, d),
+                            (Vector2){1.f, 1.f},
+                            (Vector2){world_width - size, world_height - size});
+    }
+    float left = 1; // of the step
+    for (int bounce = 0; bounce < SWEEP_BOUNCES; bounce++) {
+        size_t b = 0;
+        Axis axis = AXIS_X;
+        const float t = FirstBarrierHit(at, d, size, &b, &axis);
+        if (t > 1) {
+            if (bounce > 0) {
+                *pos = Vector2Clamp(Vector2Add(at, d),
+                                    (Vector2){1.f, 1.f},
+                                    (Vector2){world_width - size, world_height - size});
+                BounceOffWalls(*pos, velocity, size);
+            }
+            return;
+        }
+        at = Vector2Add(at, Vector2Scale(d, t));
+        const Rectangle r = barriers[b];
+        if (axis == AXIS_X) {
+            at.x = d.x > 0 ? r.x - size : r.x + r.width + 1;
+        } else {
+            at.y = d.y > 0 ? r.y - size : r.y + r.height + 1;
+        }
+        CalcVelocityAfterCollision(velocity, size, axis);
+        left *= 1 - t;
+        d = Vector2Scale(*velocity, deltaTime * left);
+    }
+    *pos = at;
+}
+
+void UpdateBoxPosition(Vector2 *pos, Vector2 *velocity, const float boxSize,
+                       const float deltaTime) {
+    float size = max(boxSize, 0);
+    const Vector2 from = *pos;
+    *pos = Vector2Clamp(Vector2Add(*pos, Vector2Scale(*velocity, deltaTime)),
+                        (Vector2){1.f, 1.f},
+                        (Vector2){world_width - size, world_height - size});
+    BounceOffWalls(*pos, velocity, size);
+    SweepBarriers(pos, velocity, from, size, deltaTime);
+    CollideWithBarriers(pos, velocity, size);
+    if (b_gravity) {
+        *velocity = Vector2Add(*velocity, Vector2Scale((Vector2){0, 5.f}, deltaTime));
+    }
+    //drag
+    *velocity = Vector2Scale(*velocity, .99995);
+}
+
+#define UPDATE_BLOCK 256
+#define update_blocks(N) (((N) + UPDATE_BLOCK - 1) / UPDATE_BLOCK)
+
+// one emitting step older; particles shrink linearly with age until they vanish
+static inline void UpdateParticle(Particles *p, const size_t i, const float shrink) {
+    p->age[i] += 1;
+    p->size[i] = PARTICLE_SIZE - p->age[i] * shrink;
+}
+
+typedef struct {
+    IntegrateParams integrate;
+    ForcesKernel forces; // IntegrateForcesKernel(&integrate), looked up once per step
+    size_t total;        // pool entries over all emitters
+    size_t blocks;       // and the UPDATE_BLOCKs they make up, each pool's last one short
+    // per emitter: brownian keys, and whether it emitted (and so aged its particles)
+    struct {
+        uint32_t keyx, keyy;
+        bool emitting;
+    } emitters[MAX_EMITTERS];
+} StepArgs;
+
+// same steps as UpdateBoxPosition plus brownian jitter for particles [start, start + n) of
+// emitter k, leaving their positions from before the move in x0 / y0; jitter for particle i is
+// drawn from counter i of the emitter's brownian keys
+static inline __attribute__((always_inline)) void MoveBlock(const size_t k, const size_t start,
+                                                            const size_t n, const StepArgs *args,
+                                                            const bool brownian, float *x0,
+                                                            float *y0) {
+    float jx[UPDATE_BLOCK], jy[UPDATE_BLOCK];
+    Particles *p = &emitters[k].particles;
+    memcpy(x0, p->x + start, n * sizeof(float));
+    memcpy(y0, p->y + start, n * sizeof(float));
+    IntegrateMove(&args->integrate,
+                  p->x + start,
+                  p->y + start,
+                  p->vx + start,
+                  p->vy + start,
+                  p->size + start,
+                  n);
+    for (size_t i = start; i < start + n; i++) {
+        Vector2 pos = {p->x[i], p->y[i]}, velocity = {p->vx[i], p->vy[i]};
+        SweepBarriers(&pos,
+                      &velocity,
+                      (Vector2){x0[i - start], y0[i - start]},
+                      max(p->size[i], 0),
+                      args->integrate.dt);
+        CollideWithBarriers(&pos, &velocity, p->size[i]);
+        p->x[i] = pos.x;
+        p->y[i] = pos.y;
+        p->vx[i] = velocity.x;
+        p->vy[i] = velocity.y;
+    }
+    if (brownian) {
+        RngFillSigned(args->emitters[k].keyx, start, 16, jx, n);
+        RngFillSigned(args->emitters[k].keyy, start, 16, jy, n);
+    }
+    args->forces(&args->integrate, p->vx + start, p->vy + start, jx, jy, n);
+}
+
+// a particle that was awake for this step's move: one step closer to sleeping if it barely
+// moved, back to zero if it didn't
+static inline void CountStill(Particles *p, const size_t i, const float x0, const float y0) {
+    if (fabsf(p->x[i] - x0) + fabsf(p->y[i] - y0) >= SLEEP_DISTANCE) {
+        p->still[i] = 0;
+    } else if (++p->still[i] == SLEEP_STEPS) {
+        p->vx[i] = p->vy[i] = 0;
+    }
+}
+
+// MoveBlock without brownian for a block with some particles asleep. Mostly asleep blocks
+// move their few awake particles one at a time; otherwise the vector kernels run over the
+// whole block and the sleepers are put back where they were.
+static inline void MoveBlockSleeping(const size_t k, const size_t start, const size_t n,
+                                     const size_t sleepers, const StepArgs *args) {
+    Particles *p = &emitters[k].particles;
+    if (sleepers >= n - n / 8) {
+        for (size_t i = start; i < start + n; i++) {
+            if (!asleep(p, i)) {
+                float x0, y0;
+                MoveBlock(k, i, 1, args, false, &x0, &y0);
+                CountStill(p, i, x0, y0);
+            }
+        }
+        return;
+    }
+    float x0[UPDATE_BLOCK], y0[UPDATE_BLOCK];
+    MoveBlock(k, start, n, args, false, x0, y0);
+    for (size_t i = start; i < start + n; i++) {
+        if (asleep(p, i)) {
+            p->x[i] = x0[i - start];
+            p->y[i] = y0[i - start];
+            p->vx[i] = p->vy[i] = 0;
+        } else {
+            CountStill(p, i, x0[i - start], y0[i - start]);
+        }
+    }
+}
+
+// MoveBlock and aging for particles [first, last) of emitter k, one cache-sized block at a
+// time; brownian and aging are constants in every instantiation below. Brownian jitter keeps
+// everyone awake, without it a block that is all asleep is only aged.
+static inline __attribute__((always_inline)) void UpdateParticleBlocks(
+    const size_t k, const size_t first, const size_t last, const StepArgs *args,
+    const bool brownian, const bool aging) {
+    Particles *p = &emitters[k].particles;
+    const float shrink = (PARTICLE_SIZE / 1.5) / emitters[k].capacity;
+    for (size_t start = first; start < last; start += UPDATE_BLOCK) {
+        const size_t n = min(last - start, UPDATE_BLOCK);
+        if (brownian) {
+            float x0[UPDATE_BLOCK], y0[UPDATE_BLOCK];
+            memset(p->still + start, 0, n);
+            MoveBlock(k, start, n, args, true, x0, y0);
+        } else {
+            size_t sleepers = 0;
+            for (size_t i = start; i < start + n; i++) {
+                sleepers += asleep(p, i);
+            }
+            if (sleepers < n) {
+                MoveBlockSleeping(k, start, n, sleepers, args);
+            }
+        }
+        if (aging) {
+            for (size_t i = start; i < start + n; i++) {
+                if (asleep(p, i)) {
+                    // nothing moves a sleeper to follow its shrinking, so it shrinks towards
+                    // the middle of its bottom edge, where it rests
+                    const float before = max(p->size[i], 0);
+                    UpdateParticle(p, i, shrink);
+                    const float lost = before - max(p->size[i], 0);
+                    p->x[i] += lost / 2;
+                    p->y[i] += lost;
+                } else {
+                    UpdateParticle(p, i, shrink);
+                }
+            }
+        }
+    }
+}
+
+typedef void (*UpdateKernel)(size_t k, size_t first, size_t last, const StepArgs *args);
+
+#define UPDATE_VARIANT(NAME, BROWNIAN, AGING)                                              \
+    static void NAME(size_t k, size_t first, size_t last, const StepArgs *args) {          \
+        UpdateParticleBlocks(k, first, last, args, BROWNIAN, AGING);                        \
+    }
+UPDATE_VARIANT(UpdatePlain, false, false)
+UPDATE_VARIANT(UpdateAging, false, true)
+UPDATE_VARIANT(UpdateBrownian, true, false)
+UPDATE_VARIANT(UpdateBrownianAging, true, true)
+
+// [brownian][aging]
+static const UpdateKernel update_kernels[2][2] = {{UpdatePlain, UpdateAging},
+                                                  {UpdateBrownian, UpdateBrownianAging}};
+
+double EmitRatio(const Emitter *em) {
+    return PARTICLE_SIZE / (em->size * max(em->capacity / (PARTICLE_INTERVAL * 70), 1));
+}
+
+// point the particle arrays at the window of the pool starting at entry first
+static void SetWindow(Emitter *e, const size_t first) {
+    float *pool = e->block;
+    e->first = first;
+    e->particles = (Particles){pool + first,
+                               pool + e->room + first,
+                               pool + 2 * e->room + first,
+                               pool + 3 * e->room + first,
+                               pool + 4 * e->room + first,
+                               pool + 5 * e->room + first,
+                               (uint8_t *) (pool + 6 * e->room) + first};
+}
+
+void ResetParticles(Emitter *e) {
+    SetWindow(e, 0);
+    e->count = 0;
+}
+
+// a slot for a newborn at the end of the window: a full pool loses its oldest particle, and a
+// window that has slid to the end of the pool is moved back to its start, once every
+// room - capacity births at most
+static size_t PushParticle(Emitter *e) {
+    if (e->count == e->capacity) {
+        SetWindow(e, e->first + 1);
+        e->count--;
+    }
+    if (e->first + e->count == e->room) {
+        float *pool = e->block;
+        for (int a = 0; a < 6; a++) {
+            memmove(pool + a * e->room, pool + a * e->room + e->first, e->count * sizeof(float));
+        }
+        memmove(pool + 6 * e->room, e->particles.still, e->count);
+        SetWindow(e, 0);
+    }
+    return e->count++;
+}
+
+// everyone ages in the same steps and size only falls with age, so the dead are always the
+// oldest: a prefix of the window, dropped by moving its start
+static void DropDeadParticles(Emitter *e) {
+    size_t dead = 0;
+    while (dead < e->count && e->particles.size[dead] <= 0) {
+        dead++;
+    }
+    if (dead > 0) {
+        SetWindow(e, e->first + dead);
+        e->count -= dead;
+    }
+}
+
+void emitParticle(Emitter *e, const uint64_t seed, const float frameTime) {
+    const size_t i = PushParticle(e);
+    Particles *p = &e->particles;
+    p->size[i] = PARTICLE_SIZE;
+    p->age[i] = 0;
+    p->still[i] = 0;
+    Vector2 pos_offset = e->emit_offset;
+    pos_offset.x += p->size[i];
+    if (pos_offset.x > e->size - PARTICLE_SIZE) {
+        pos_offset.x = e->size > PARTICLE_SIZE * 2 ? PARTICLE_SIZE / 2. : 0;
+        pos_offset.y += p->size[i];
+    }
+    if (pos_offset.y > e->size - PARTICLE_SIZE) {
+        pos_offset.y = e->size > PARTICLE_SIZE * 2 ? PARTICLE_SIZE / 2. : 0;
+    }
+    if (b_nwtn3rd && e->size > PARTICLE_SIZE * 2) {
+        if (e->rocket[UP] || e->rocket[DOWN]) {
+            pos_offset.y = e->rocket[UP] ? e->size - PARTICLE_SIZE : 0;
+        }
+        if (e->rocket[LEFT]) {
+            pos_offset.x = e->size - PARTICLE_SIZE;
+        }
+        if (e->rocket[RIGHT]) {
+            pos_offset.x = 0;
+        }
+    }
+    p->x[i] = e->pos.x + pos_offset.x;
+    p->y[i] = e->pos.y + pos_offset.y;
+    if (e->rocket[RIGHT]) {
+        pos_offset.y += p->size[i];
+    }
+    e->emit_offset = pos_offset;
+    Vector2 fuzz = (Vector2){RngSigned(RngKey(seed, frames, RNG_EMIT_X), i, 64) * 8.f,
+                             RngSigned(RngKey(seed, frames, RNG_EMIT_Y), i, 128) * 16.f};
+
+    fuzz = Vector2Add(Vector2Scale(e->velocity, e->ratio), fuzz);
+    if (b_nwtn3rd) {
+        if (e->rocket[UP]) {
+            if (fuzz.y < 0)
+                fuzz.y = -1. * fuzz.y;
+        } else if (e->rocket[DOWN]) {
+            if (fuzz.y > 0)
+                fuzz.y = -1 * fuzz.y;
+        }
+        if (e->rocket[LEFT]) {
+            if (fuzz.x < 0)
+                fuzz.x = -1 * fuzz.x;
+        } else if (e->rocket[RIGHT]) {
+            if (fuzz.x > 0)
+                fuzz.x = -1 * fuzz.x;
+        }
+    }
+    p->vx[i] = fuzz.x;
+    p->vy[i] = fuzz.y;
+    if (b_nwtn3rd) {
+        e->velocity = Vector2Subtract(e->velocity,
+                                      Vector2Scale(fuzz, frameTime * e->ratio * 1024));
+    }
+}
+
+#define CELL_SIZE 64
+
+#define box_center_pos(BOX) Vector2Add((BOX).pos, (Vector2){(BOX).size / 2., (BOX).size / 2.})
+
+#define particle_center_pos(P, I) \
+    ((Vector2){(P)->x[(I)] + (P)->size[(I)] / 2.f, (P)->y[(I)] + (P)->size[(I)] / 2.f})
+
+#define grid_col(X) min(max((int) floorf((X) / CELL_SIZE), 0), grid_cols - 1)
+#define grid_row(Y) min(max((int) floorf((Y) / CELL_SIZE), 0), grid_rows - 1)
+#define get_cell(P, I) ((struct { int x, y; }){grid_col((P)->x[(I)]), grid_row((P)->y[(I)])})
+
+// the emitters' pools taken back to back as UPDATE_BLOCKs, each pool's last one short: visit
+// the blocks [FIRST, LAST) that fall in each emitter K as its local range [LO, HI), which
+// starts on a multiple of UPDATE_BLOCK in that pool
+#define for_emitter_blocks(FIRST, LAST, K, LO, HI) \
+    for (size_t K = 0, base_ = 0, LO, HI; K < num_emitters && base_ < (LAST); \
+         base_ += update_blocks(emitters[K++].count)) \
+        if ((LO = (max((FIRST), base_) - base_) * UPDATE_BLOCK, \
+             HI = min((min((LAST), base_ + update_blocks(emitters[K].count)) - base_) \
+                          * UPDATE_BLOCK, \
+                      emitters[K].count), \
+             LO < HI))
+
+// a particle of any emitter
+typedef struct {
+    uint32_t emitter, index;
+} ParticleRef;
+
+// uniform grid over the particles of every emitter, rebuilt every step with a counting sort:
+// particles in cell c are slots cell_start[c] .. cell_start[c + 1]. Slot s is particle
+// cell_particles[s]; the pools stay oldest first, so the pair pass works on copies of what it
+// reads gathered into grid order, neighbours next to each other, and adds its impulses up
+// per slot in cell_rx / cell_ry. cell_settled marks sleepers with nothing awake in their own
+// or the eight neighbouring cells, which the pair pass leaves out.
+static int grid_cols, grid_rows; // over the world
+static size_t *cell_start, *cell_fill;
+static ParticleRef *cell_particles;
+static float *cell_x, *cell_y, *cell_size, *cell_rx, *cell_ry;
+static bool *cell_settled;
+static size_t cell_capacity;
+
+static bool GrowGrid(const size_t slots) {
+    if (slots <= cell_capacity) {
+        return true;
+    }
+    // every slot is rewritten by the next BuildGrid, nothing to carry over
+    void *block = malloc(slots * (sizeof(ParticleRef) + 5 * sizeof(float) + sizeof(bool)));
+    if (!block) {
+        return false;
+    }
+    free(cell_particles);
+    cell_particles = block;
+    cell_x = (float *) (cell_particles + slots);
+    cell_y = cell_x + slots;
+    cell_size = cell_y + slots;
+    cell_rx = cell_size + slots;
+    cell_ry = cell_rx + slots;
+    cell_settled = (bool *) (cell_ry + slots);
+    cell_capacity = slots;
+    return true;
+}
+
+void BuildGrid(void) {
+    const size_t cells = (size_t) grid_cols * grid_rows;
+    memset(cell_start, 0, (cells + 1) * sizeof(*cell_start));
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Particles *p = &emitters[k].particles;
+        int *particle_cell = emitters[k].particle_cell;
+        for (size_t i = 0; i < emitters[k].count; i++) {
+            const int c = get_cell(p, i).y * grid_cols + get_cell(p, i).x;
+            particle_cell[i] = c;
+            cell_start[c + 1]++;
+        }
+    }
+    for (size_t c = 0; c < cells; c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+    memcpy(cell_fill, cell_start, cells * sizeof(*cell_fill));
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Particles *p = &emitters[k].particles;
+        const int *particle_cell = emitters[k].particle_cell;
+        for (size_t i = 0; i < emitters[k].count; i++) {
+            const size_t s = cell_fill[particle_cell[i]]++;
+            cell_particles[s] = (ParticleRef){k, i};
+            cell_x[s] = p->x[i];
+            cell_y[s] = p->y[i];
+            cell_size[s] = p->size[i];
+            cell_settled[s] = asleep(p, i);
+            cell_rx[s] = cell_ry[s] = 0;
+        }
+    }
+    // a sleeper near anything awake gets every push, its sleeping neighbours' too, so that
+    // ApplyRepulsion sees whether they still hold it up
+    size_t *awake = cell_fill; // the fill cursors are spent
+    for (size_t c = 0; c < cells; c++) {
+        awake[c] = 0;
+        for (size_t s = cell_start[c]; s < cell_start[c + 1]; s++) {
+            awake[c] += !cell_settled[s];
+        }
+    }
+    for (int cy = 0; cy < grid_rows; cy++) {
+        for (int cx = 0; cx < grid_cols; cx++) {
+            size_t near = 0;
+            for (int y = max(cy - 1, 0); y <= min(cy + 1, grid_rows - 1); y++) {
+                for (int x = max(cx - 1, 0); x <= min(cx + 1, grid_cols - 1); x++) {
+                    near += awake[y * grid_cols + x];
+                }
+            }
+            if (near > 0) {
+                const size_t c = cy * grid_cols + cx;
+                memset(cell_settled + cell_start[c], 0, cell_start[c + 1] - cell_start[c]);
+            }
+        }
+    }
+}
+
+// whether a velocity change of dv would move sleeper i of p at least SLEEP_DISTANCE in a step
+// of dt; what only presses it into a wall or a barrier leaves it where it is
+static bool Stirs(const Particles *p, const size_t i, Vector2 dv, const float dt) {
+    const float size = max(p->size[i], 0);
+    if (fabsf(dv.x) + fabsf(dv.y) < SLEEP_DISTANCE / dt) {
+        return false;
+    }
+    Vector2 pos = Vector2Clamp(Vector2Add((Vector2){p->x[i], p->y[i]}, Vector2Scale(dv, dt)),
+                               (Vector2){1.f, 1.f},
+                               (Vector2){world_width - size, world_height - size});
+    CollideWithBarriers(&pos, &dv, size);
+    return fabsf(pos.x - p->x[i]) + fabsf(pos.y - p->y[i]) >= SLEEP_DISTANCE;
+}
+
+void RepulseBox(Particles *p, const size_t i, const Vector2 repulsorCenter,
+                const float repulsorSize, const double dt) {
+    const float radius = max(p->size[i], repulsorSize) * repulsion_radius;
+    const Vector2 center = particle_center_pos(p, i);
+    const float dist = Vector2Distance(center, repulsorCenter);
+    if (dist < radius) {
+        const float size_ratio = repulsorSize / p->size[i];
+        const Vector2 direction = Vector2Normalize(Vector2Subtract(center, repulsorCenter));
+        const float intensity = Clamp((radius) / ((dist / (radius / 2)) * (dist / (radius / 2))),
+                                      0,
+                                      100);
+        float factor = repulsion_factor;
+        const Vector2 deltaV = Vector2Scale(direction, dt * size_ratio * factor * intensity);
+        if (asleep(p, i)) {
+            if (!Stirs(p, i, deltaV, dt * TIMESCALE)) {
+                return;
+            }
+            p->still[i] = 0;
+        }
+        p->vx[i] += deltaV.x;
+        p->vy[i] += deltaV.y;
+    }
+}
+
+// each neighbouring pair of slots once: equal and opposite impulses, each scaled by the other
+// box's size relative to its own, exactly what RepulseBox gives from either side. The impulses
+// go into cell_rx / cell_ry, added to the velocities by ApplyRepulsion.
+static inline void RepulsePair(const size_t a, const size_t b, const float dt) {
+    if (cell_settled[a] && cell_settled[b]) {
+        // at rest against each other, and nothing awake about to change that
+        return;
+    }
+    const float radius = max(cell_size[a], cell_size[b]) * repulsion_radius;
+    const Vector2 ca = {cell_x[a] + cell_size[a] / 2.f, cell_y[a] + cell_size[a] / 2.f},
+                  cb = {cell_x[b] + cell_size[b] / 2.f, cell_y[b] + cell_size[b] / 2.f};
+    const float dist = Vector2Distance(ca, cb);
+    if (dist < radius) {
+        const Vector2 direction = Vector2Normalize(Vector2Subtract(ca, cb));
+        const float intensity = Clamp((radius) / ((dist / (radius / 2)) * (dist / (radius / 2))),
+                                      0,
+                                      100);
+        const float impulse = dt * repulsion_factor * intensity;
+        const float toA = impulse * (cell_size[b] / cell_size[a]),
+                    toB = impulse * (cell_size[a] / cell_size[b]);
+        cell_rx[a] += direction.x * toA;
+        cell_ry[a] += direction.y * toA;
+        cell_rx[b] -= direction.x * toB;
+        cell_ry[b] -= direction.y * toB;
+    }
+}
+
+// pairs owned by the cells of row cy: inside each cell, with the cell to the east, and with
+// the three cells below. Writes reach row cy + 1 at most, so rows of equal parity can run
+// concurrently, and each particle sees its contributions in a fixed order.
+void RepulseRow(const int cy, const float dt) {
+    for (int cx = 0; cx < grid_cols; cx++) {
+        const size_t c = cy * grid_cols + cx;
+        for (size_t a = cell_start[c]; a < cell_start[c + 1]; a++) {
+            // the rest of this cell and the cell to the east are contiguous
+            const size_t last = cell_start[c + 1 + (cx + 1 < grid_cols)];
+            for (size_t b = a + 1; b < last; b++) {
+                RepulsePair(a, b, dt);
+            }
+            if (cy + 1 < grid_rows) {
+                const size_t below = (cy + 1) * grid_cols;
+                for (size_t b = cell_start[below + max(cx - 1, 0)];
+                     b < cell_start[below + min(cx + 1, grid_cols - 1) + 1];
+                     b++) {
+                    RepulsePair(a, b, dt);
+                }
+            }
+        }
+    }
+}
+
+// every emitter pushes the particles around it, its own and everyone else's
+void RepulseFromEmitters(const float dt) {
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Emitter *em = &emitters[k];
+        const Vector2 center = box_center_pos(*em);
+        // RepulseBox reaches max(size, em->size) * repulsion_radius from the particle's
+        // centre, and particles are binned by their top-left corner
+        const float reach = max(PARTICLE_SIZE, em->size) * repulsion_radius + PARTICLE_SIZE;
+        const int x0 = grid_col(center.x - reach), x1 = grid_col(center.x + reach);
+        for (int cy = grid_row(center.y - reach); cy <= grid_row(center.y + reach); cy++) {
+            const size_t row = (size_t) cy * grid_cols;
+            for (size_t b = cell_start[row + x0]; b < cell_start[row + x1 + 1]; b++) {
+                const ParticleRef ref = cell_particles[b];
+                RepulseBox(&emitters[ref.emitter].particles, ref.index, center, em->size, dt);
+            }
+        }
+    }
+}
+
+typedef struct {
+    float dt;
+    int parity;
+    size_t total;  // pool entries over all emitters
+    float gravity; // what it adds to the velocity of a particle a step
+} RepulsionArgs;
+
+void DoRepulsionRows(size_t worker, size_t nworkers, void *arg) {
+    const double start = ClockNow();
+    const RepulsionArgs *args = arg;
+    for (int cy = args->parity + 2 * worker; cy < grid_rows; cy += 2 * nworkers) {
+        RepulseRow(cy, args->dt);
+    }
+    ProfWorkerBusy(worker, ClockNow() - start);
+}
+
+// each particle has one slot, so the slots split across workers without overlap
+void ApplyRepulsion(size_t worker, size_t nworkers, void *arg) {
+    const double start = ClockNow();
+    const RepulsionArgs *args = arg;
+    size_t first, last;
+    PoolSplit(args->total, worker, nworkers, &first, &last);
+    for (size_t s = first; s < last; s++) {
+        if (cell_settled[s]) {
+            // only some of its pushes were added up, and nothing near it moved
+            continue;
+        }
+        Particles *p = &emitters[cell_particles[s].emitter].particles;
+        const size_t i = cell_particles[s].index;
+        if (asleep(p, i)) {
+            // at rest the pushes hold it up against the gravity it is spared while asleep
+            const Vector2 net = {cell_rx[s], cell_ry[s] + args->gravity};
+            if (!Stirs(p, i, net, args->dt * TIMESCALE)) {
+                continue;
+            }
+            p->still[i] = 0;
+        }
+        p->vx[i] += cell_rx[s];
+        p->vy[i] += cell_ry[s];
+    }
+    ProfWorkerBusy(worker, ClockNow() - start);
+}
+
+// impulse on a box of side size centred at c from boxes totalling weight in size, the largest
+// of them largest, centred at from: RepulsePair's law, which for a single box it is
+static inline Vector2 TreeImpulse(const Vector2 c, const float size, const Vector2 from,
+                                  const float weight, const float largest, const float dt) {
+    const float radius = max(size, largest) * repulsion_radius;
+    const float dist = Vector2Distance(c, from);
+    if (dist >= radius) {
+        return Vector2Zero();
+    }
+    const Vector2 direction = Vector2Normalize(Vector2Subtract(c, from));
+    const float intensity = Clamp((radius) / ((dist / (radius / 2)) * (dist / (radius / 2))),
+                                  0,
+                                  100);
+    return Vector2Scale(direction, dt * repulsion_factor * intensity * (weight / size));
+}
+
+// TreeImpulse summed over the boxes below node as if they all sat at its centre. Each box
+// pushes with max(size, its size)^3 times its size; that sum is at least size^3 * weight and at
+// least weight4, exactly one of them when the boxes are all smaller or all larger, and taken
+// as the larger of the two.
+static inline Vector2 GroupImpulse(const Vector2 c, const float size, const QuadNode *node,
+                                   const float dt) {
+    const Vector2 offset = Vector2Subtract(c, (Vector2){node->cx, node->cy});
+    const float dist2 = Vector2LengthSqr(offset);
+    const float r3 = repulsion_radius * repulsion_radius * repulsion_radius;
+    const float moment = max(size * size * size * node->weight, node->weight4) * r3;
+    // TreeImpulse's intensity is radius^3 / (4 dist^2), clamped to 100 per box
+    const float intensity = min(moment / (4 * dist2), 100 * node->weight);
+    return Vector2Scale(Vector2Normalize(offset), dt * repulsion_factor * intensity / size);
+}
+
+// whether all of node's centres lie closer than reach to c
+static inline bool Within(const Vector2 c, const QuadNode *node, const float reach) {
+    const float dx = max(c.x - node->x0, node->x1 - c.x), dy = max(c.y - node->y0, node->y1 - c.y);
+    return dx * dx + dy * dy < reach * reach;
+}
+
+// everything in reach of the box in slot s, through the quadtree: nodes whose boxes are all
+// out of reach are skipped, nodes wholly in reach that look smaller than opening_angle from the
+// box push as one group from their centre, the rest are opened down to single boxes. Only
+// slot s is written, so the slots split across workers like in ApplyRepulsion.
+static void RepulseThroughTree(const size_t s, const float dt) {
+    const float size = cell_size[s];
+    const Vector2 c = {cell_x[s] + size / 2.f, cell_y[s] + size / 2.f};
+    Vector2 impulse = Vector2Zero();
+    for (size_t n = 0; n < num_quad_nodes;) {
+        const QuadNode *node = &quad_nodes[n];
+        const float reach = max(size, node->max_size) * repulsion_radius;
+        const float dx = max(max(node->x0 - c.x, c.x - node->x1), 0),
+                    dy = max(max(node->y0 - c.y, c.y - node->y1), 0);
+        if (dx * dx + dy * dy >= reach * reach) {
+            n = node->skip;
+        } else if (node->leaf) {
+            for (size_t b = node->first; b < node->first + node->count; b++) {
+                const QuadBox *box = &quad_boxes[b];
+                if (box->index != s) {
+                    impulse = Vector2Add(impulse,
+                                         TreeImpulse(c,
+                                                     size,
+                                                     (Vector2){box->cx, box->cy},
+                                                     box->size,
+                                                     box->size,
+                                                     dt));
+                }
+            }
+            n = node->skip;
+        } else if ((dx > 0 || dy > 0) && Within(c, node, reach)
+                   && max(node->x1 - node->x0, node->y1 - node->y0)
+                          < opening_angle * Vector2Distance(c, (Vector2){node->cx, node->cy})) {
+            // outside the node's bounds, so the box itself is not part of the aggregate
+            impulse = Vector2Add(impulse, GroupImpulse(c, size, node, dt));
+            n = node->skip;
+        } else {
+            n++;
+        }
+    }
+    cell_rx[s] += impulse.x;
+    cell_ry[s] += impulse.y;
+}
+
+void DoRepulsionTree(size_t worker, size_t nworkers, void *arg) {
+    const double start = ClockNow();
+    const RepulsionArgs *args = arg;
+    size_t first, last;
+    // on the same block boundaries as the integration, whatever the worker count
+    PoolSplitAligned(args->total, UPDATE_BLOCK, worker, nworkers, &first, &last);
+    for (size_t s = first; s < last; s++) {
+        // ApplyRepulsion leaves settled slots alone
+        if (!cell_settled[s]) {
+            RepulseThroughTree(s, args->dt);
+        }
+    }
+    ProfWorkerBusy(worker, ClockNow() - start);
+}
+
+void DoBoxRepulsion(const float dt, const size_t total, const float gravity) {
+    BuildGrid();
+    RepulsionArgs args = {dt, 0, total, gravity};
+    // the grid only pairs up neighbouring cells; the tree reaches as far as the radius does
+    if (b_barnes_hut && QuadtreeBuild(cell_x, cell_y, cell_size, total)) {
+        PoolRun(DoRepulsionTree, &args);
+    } else {
+        PoolRun(DoRepulsionRows, &args);
+        args.parity = 1;
+        PoolRun(DoRepulsionRows, &args);
+    }
+    RepulseFromEmitters(dt);
+    PoolRun(ApplyRepulsion, &args);
+}
+
+void UpdateParticlesForWorker(size_t worker, size_t nworkers, void *arg) {
+    const StepArgs *args = arg;
+    size_t first, last;
+    // in whole blocks of each pool, so where the vector kernels run and where their scalar
+    // tails do doesn't depend on the worker count: -Ofast rounds the two differently
+    PoolSplit(args->blocks, worker, nworkers, &first, &last);
+    const bool brownian = args->integrate.brown_factor != 0;
+    for_emitter_blocks(first, last, k, lo, hi) {
+        update_kernels[brownian][args->emitters[k].emitting](k, lo, hi, args);
+    }
+}
+
+// emitters and particles that new barriers came down on go out through the nearest face, as
+// if the barriers had stopped them there; the steps after only look at their edges
+static void PushOutOfNewBarriers(void) {
+    for (size_t k = 0; k < num_emitters; k++) {
+        Emitter *em = &emitters[k];
+        PushOutOfBarriers(&em->pos, em->size);
+        Particles *p = &em->particles;
+        for (size_t i = 0; i < em->count; i++) {
+            Vector2 at = {p->x[i], p->y[i]};
+            if (PushOutOfBarriers(&at, max(p->size[i], 0))) {
+                p->x[i] = at.x;
+                p->y[i] = at.y;
+                p->still[i] = 0;
+            }
+        }
+    }
+}
+
+// random placements tried before the world counts as full, however many barriers are asked for
+#define MAX_PLACEMENT_ATTEMPTS (1u << 20)
+
+void generateRandomBarriers(void){
+    // past the default count per screenful, shrink barriers so that many of them still fit
+    const float screens = world_width * world_height / ((float) SCREEN_WIDTH * SCREEN_HEIGHT);
+    const float scale = min(1.f, sqrtf(NUM_BARRIERS * screens / max(max_barriers, 1)));
+    const int min_side = max(48 * scale, 4), max_side = max(480 * scale, min_side);
+    // placed barriers bucketed by top-left corner in cells at least max_side wide, so one can
+    // only overlap those from its own and the neighbouring cells; no more cells than barriers
+    const float cell = max(max_side, sqrtf(world_width * world_height / max(max_barriers, 1)));
+    const int cols = (int) ceilf(world_width / cell), rows = (int) ceilf(world_height / cell);
+    int *bucket = malloc(((size_t) cols * rows + max_barriers) * sizeof(int));
+    if (!bucket) {
+        fprintf(stderr, "could not place barriers\n");
+        num_barriers = 0;
+        BuildBarrierGrid();
+        return;
+    }
+    // bucket[c] is the last barrier placed in cell c, next[i] the one before i, -1 ends both
+    int *next = bucket + (size_t) cols * rows;
+    memset(bucket, -1, (size_t) cols * rows * sizeof(int));
+    // drawn from the frame's own stream, so a replayed CMD_REGENERATE places the same ones
+    const uint32_t key = RngKey(sim_seed, frames, RNG_BARRIERS);
+    size_t placed = 0;
+    for (uint32_t attempt = 0; placed < max_barriers && attempt < MAX_PLACEMENT_ATTEMPTS;
+         attempt++) {
+        const uint32_t draw = 4 * attempt;
+        const Rectangle b = {RngRange(key, draw, 128, world_width - 128),
+                             RngRange(key, draw + 1, 128, world_height - 128),
+                             RngRange(key, draw + 2, min_side, max_side),
+                             RngRange(key, draw + 3, min_side, max_side)};
+        if (b.x + b.width > world_width - 128 || b.y + b.height > world_height - 128) {
+            //no barriers go off the world
+            continue;
+        }
+        const int cx = min((int) (b.x / cell), cols - 1), cy = min((int) (b.y / cell), rows - 1);
+        bool clear = true;
+        for (int y = max(cy - 1, 0); clear && y <= min(cy + 1, rows - 1); y++) {
+            for (int x = max(cx - 1, 0); clear && x <= min(cx + 1, cols - 1); x++) {
+                for (int j = bucket[y * cols + x]; j >= 0; j = next[j]) {
+                    const Rectangle collision = GetCollisionRec(b, barriers[j]);
+                    if (collision.height > 0 || collision.width > 0) {
+                        //no 2 barriers can intersect
+                        clear = false;
+                        break;
+                    }
+                }
+            }
+        }
+        if (clear) {
+            barriers[placed] = b;
+            next[placed] = bucket[cy * cols + cx];
+            bucket[cy * cols + cx] = placed++;
+        }
+    }
+    free(bucket);
+    if (placed < max_barriers) {
+        //world is full, keep what fits
+        fprintf(stderr, "placed %zu of %zu barriers\n", placed, max_barriers);
+    }
+    num_barriers = placed;
+    BuildBarrierGrid();
+    PushOutOfNewBarriers();
+}
+
+bool SetBarriers(const Rectangle *src, const size_t n) {
+    if (n > max_barriers) {
+        Rectangle *grown = realloc(barriers, n * sizeof(*barriers));
+        if (!grown) {
+            return false;
+        }
+        barriers = grown;
+        max_barriers = n;
+    }
+    memcpy(barriers, src, n * sizeof(*barriers));
+    num_barriers = n;
+    BuildBarrierGrid();
+    return true;
+}
+
+// carve one page-aligned block into the emitter's particle pool and its simulation scratch
+bool AllocParticles(Emitter *e, const size_t capacity, const bool hugepages) {
+    // a multiple of 16 floats keeps every array on its own 64-byte boundary; twice the
+    // capacity in the pool lets the window slide that far before it has to move
+    const size_t stride = (capacity + 15) & ~(size_t) 15, room = 2 * stride;
+    // the still counters are bytes, padded back to a multiple of 16 floats
+    const size_t still_floats = (room / sizeof(float) + 15) & ~(size_t) 15;
+    const size_t bytes = (6 * room + still_floats) * sizeof(float) + stride * sizeof(int);
+    float *block = PageAlloc(bytes, hugepages);
+    if (!block) {
+        return false;
+    }
+    PageFree(e->block, e->block_bytes);
+    e->block = block;
+    e->block_bytes = bytes;
+    e->room = room;
+    e->particle_cell = (int *) (block + 6 * room + still_floats);
+    e->capacity = capacity;
+    ResetParticles(e);
+    return true;
+}
+
+void WakeParticles(void) {
+    for (size_t k = 0; k < num_emitters; k++) {
+        memset(emitters[k].particles.still, 0, emitters[k].count);
+    }
+}
+
+void ClearEmitters(const size_t capacity) {
+    for (size_t k = 0; k < num_emitters; k++) {
+        PageFree(emitters[k].block, emitters[k].block_bytes);
+        memset(&emitters[k], 0, sizeof(emitters[k]));
+    }
+    num_emitters = 0;
+    active_emitter = 0;
+    emitter_capacity = capacity;
+}
+
+bool SpawnEmitter(const Vector2 pos) {
+    if (num_emitters == MAX_EMITTERS) {
+        return false;
+    }
+    // the shared grid indexes every emitter's pool
+    if (!GrowGrid((num_emitters + 1) * emitter_capacity)) {
+        return false;
+    }
+    Emitter *em = &emitters[num_emitters];
+    *em = (Emitter){.pos = pos,
+                    .velocity = (Vector2){-80.f, -80.f},
+                    .color = (Color){0xFF, 0xFF, 0xFF, 0xFF},
+                    .size = EMITTER_SIZE,
+                    .ratio = PARTICLE_SIZE / (EMITTER_SIZE * (1000 / (PARTICLE_INTERVAL * 70))),
+                    .emit_offset = (Vector2){PARTICLE_SIZE / 2., PARTICLE_SIZE / 2.}};
+    if (!AllocParticles(em, emitter_capacity, emitter_hugepages)) {
+        return false;
+    }
+    memset(emitters[active_emitter].rocket, 0, sizeof(emitters[active_emitter].rocket));
+    emitters[active_emitter].thrust = 0;
+    active_emitter = num_emitters++;
+    return true;
+}
+
+static size_t ParseCount(const char *s, const size_t fallback) {
+    char *end;
+    const unsigned long long n = strtoull(s, &end, 10);
+    return end != s && *end == '\0' ? (size_t) n : fallback;
+}
+
+// WxH, each clamped to the allowed sides; anything else leaves the config as it was
+static void ParseWorld(const char *s, SimConfig *config) {
+    float width, height;
+    char end;
+    if (sscanf(s, "%fx%f%c", &width, &height, &end) == 2) {
+        config->world_width = Clamp(width, MIN_WORLD_SIDE, MAX_WORLD_SIDE);
+        config->world_height = Clamp(height, MIN_WORLD_SIDE, MAX_WORLD_SIDE);
+    }
+}
+
+SimConfig SimConfigFromArgs(int argc, char **argv) {
+    SimConfig config = {DEFAULT_PARTICLES, 1, 0, NUM_BARRIERS, false, NULL, NULL, 0, 0, false};
+    const char *env;
+    if ((env = getenv("PARTICLETEST_PARTICLES"))) {
+        config.capacity = ParseCount(env, config.capacity);
+    }
+    if ((env = getenv("PARTICLETEST_EMITTERS"))) {
+        config.emitters = ParseCount(env, config.emitters);
+    }
+    if ((env = getenv("PARTICLETEST_THREADS"))) {
+        config.threads = ParseCount(env, config.threads);
+    }
+    if ((env = getenv("PARTICLETEST_BARRIERS"))) {
+        config.barriers = ParseCount(env, config.barriers);
+    }
+    if ((env = getenv("PARTICLETEST_HUGEPAGES"))) {
+        config.hugepages = ParseCount(env, 0) != 0;
+    }
+    if ((env = getenv("PARTICLETEST_PROFILE_CSV"))) {
+        config.profile_csv = env;
+    }
+    if ((env = getenv("PARTICLETEST_REPLAY"))) {
+        config.replay = env;
+    }
+    if ((env = getenv("PARTICLETEST_WORLD"))) {
+        ParseWorld(env, &config);
+    }
+    if ((env = getenv("PARTICLETEST_CAPTURE_PNG"))) {
+        config.capture_png = ParseCount(env, 0) != 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--particles") && i + 1 < argc) {
+            config.capacity = ParseCount(argv[++i], config.capacity);
+        } else if (!strcmp(argv[i], "--emitters") && i + 1 < argc) {
+            config.emitters = ParseCount(argv[++i], config.emitters);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            config.threads = ParseCount(argv[++i], config.threads);
+        } else if (!strcmp(argv[i], "--barriers") && i + 1 < argc) {
+            config.barriers = ParseCount(argv[++i], config.barriers);
+        } else if (!strcmp(argv[i], "--hugepages")) {
+            config.hugepages = true;
+        } else if (!strcmp(argv[i], "--profile-csv") && i + 1 < argc) {
+            config.profile_csv = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            config.replay = argv[++i];
+        } else if (!strcmp(argv[i], "--world") && i + 1 < argc) {
+            ParseWorld(argv[++i], &config);
+        } else if (!strcmp(argv[i], "--capture-png")) {
+            config.capture_png = true;
+        } else {
+            fprintf(stderr, "ignoring unknown argument '%s'\n", argv[i]);
+        }
+    }
+    if (config.capacity < 2) {
+        config.capacity = 2;
+    }
+    config.emitters = min(max(config.emitters, 1), MAX_EMITTERS);
+    if (config.barriers > MAX_BARRIERS) {
+        config.barriers = MAX_BARRIERS;
+    }
+    return config;
+}
+
+bool SetWorldSize(const float width, const float height) {
+    if (!(width >= MIN_WORLD_SIDE && width <= MAX_WORLD_SIDE && height >= MIN_WORLD_SIDE
+          && height <= MAX_WORLD_SIDE)) {
+        return false;
+    }
+    // each grid keeps its starts and fill cursors in one block, cells + 1 then cells
+    const int bcols = (int) ceilf(width / BARRIER_CELL_SIZE),
+              brows = (int) ceilf(height / BARRIER_CELL_SIZE);
+    const int gcols = (int) ceilf(width / CELL_SIZE), grows = (int) ceilf(height / CELL_SIZE);
+    size_t *barrier_block = malloc((2 * (size_t) bcols * brows + 1) * sizeof(size_t));
+    size_t *grid_block = malloc((2 * (size_t) gcols * grows + 1) * sizeof(size_t));
+    if (!barrier_block || !grid_block) {
+        free(barrier_block);
+        free(grid_block);
+        return false;
+    }
+    free(barrier_cell_start);
+    free(cell_start);
+    barrier_cols = bcols;
+    barrier_rows = brows;
+    barrier_cell_start = barrier_block;
+    barrier_cell_fill = barrier_block + (size_t) bcols * brows + 1;
+    grid_cols = gcols;
+    grid_rows = grows;
+    cell_start = grid_block;
+    cell_fill = grid_block + (size_t) gcols * grows + 1;
+    world_width = width;
+    world_height = height;
+    BuildBarrierGrid();
+    return true;
+}
+
+bool SimInit(const SimConfig *config) {
+    emitter_capacity = config->capacity;
+    emitter_hugepages = config->hugepages;
+    if (!SetWorldSize(config->world_width > 0 ? config->world_width : SCREEN_WIDTH,
+                      config->world_height > 0 ? config->world_height : SCREEN_HEIGHT)) {
+        fprintf(stderr,
+                "could not make a %.0fx%.0f world\n",
+                config->world_width,
+                config->world_height);
+        return false;
+    }
+    for (size_t k = 0; k < config->emitters; k++) {
+        // the first emitter starts in the middle, the rest spread out over a low-discrepancy
+        // sequence so they don't bunch up
+        const Vector2 pos = k == 0 ? (Vector2){world_width / 2.f, world_height / 2.f}
+                                   : (Vector2){fmodf(.5f + k * .7548777f, 1) * world_width,
+                                               fmodf(.5f + k * .5698403f, 1) * world_height};
+        if (!SpawnEmitter(Vector2Clamp(pos,
+                                       (Vector2){1.f, 1.f},
+                                       (Vector2){world_width - EMITTER_SIZE,
+                                                 world_height - EMITTER_SIZE}))) {
+            fprintf(stderr,
+                    "could not allocate a pool of %zu particles for emitter %zu\n",
+                    config->capacity,
+                    k);
+            return false;
+        }
+    }
+    active_emitter = 0;
+    max_barriers = config->barriers;
+    barriers = calloc(max(max_barriers, 1), sizeof(*barriers));
+    if (!barriers) {
+        fprintf(stderr, "could not allocate %zu barriers\n", max_barriers);
+        return false;
+    }
+    const Vector3 hsv = ColorToHSV(PARTICLE_COLOR);
+    for (size_t k = 0; k < PALETTE_SIZE; k++) {
+        palette[k] = ColorFromHSV(10 + 350.f * k / PALETTE_SIZE, hsv.y, hsv.z);
+    }
+    palette_start = fmodf(hsv.x + 340, 350) * PALETTE_SIZE / 350;
+    PoolInit(config->threads);
+    IntegrateInit();
+    RngInit();
+    return true;
+}
+
+void SimSeed(const uint64_t seed) {
+    sim_seed = seed;
+    SetRandomSeed((unsigned) (seed ^ (seed >> 32)));
+}
+
+void SimShutdown(void) {
+    PoolShutdown();
+    ClearEmitters(0);
+    free(cell_particles);
+    cell_particles = NULL;
+    cell_capacity = 0;
+    QuadtreeFree();
+    free(barriers);
+    free(barrier_cells);
+    free(barrier_cell_start);
+    free(cell_start);
+    barriers = NULL;
+    barrier_cells = NULL;
+    barrier_cell_start = barrier_cell_fill = NULL;
+    cell_start = cell_fill = NULL;
+    num_barriers = 0;
+}
+
+#define emitter_push(E, DV) \
+    ((E)->velocity = Vector2Clamp(Vector2Add((E)->velocity, (DV)), \
+                                  (Vector2){-100, -100}, \
+                                  (Vector2){100, 100}))
+
+// the held directions of an emitter, once per tick: thrusters with Newton's 3rd, a push without
+static void ApplyThrust(Emitter *em) {
+    static const Vector2 push[4] = {{0., -0.5}, {0., 0.5}, {-0.5, 0.}, {0.5, 0.}};
+    for (int d = UP; d <= RIGHT; d++) {
+        if (em->thrust & (1u << d)) {
+            if (b_nwtn3rd) {
+                em->rocket[d] = true;
+            } else {
+                emitter_push(em, push[d]);
+            }
+        } else {
+            em->rocket[d] = false;
+        }
+    }
+}
+
+void SimApply(const SimCommand *cmd) {
+    Emitter *active = &emitters[active_emitter];
+    switch (cmd->type) {
+    case CMD_STOP_ALL:
+        for (size_t k = 0; k < num_emitters; k++) {
+            emitters[k].velocity = Vector2Zero();
+            memset(emitters[k].particles.vx, 0, emitters[k].count * sizeof(float));
+            memset(emitters[k].particles.vy, 0, emitters[k].count * sizeof(float));
+        }
+        break;
+    case CMD_REGENERATE:
+        generateRandomBarriers();
+        for (size_t k = 0; k < num_emitters; k++) {
+            ResetParticles(&emitters[k]);
+        }
+        break;
+    case CMD_TOGGLE_GRAVITY:
+        b_gravity = !b_gravity;
+        // particles resting on something may have to fall, or float off
+        WakeParticles();
+        break;
+    case CMD_TOGGLE_BROWNIAN:
+        b_brownian = !b_brownian;
+        break;
+    case CMD_TOGGLE_NWTN3RD:
+        b_nwtn3rd = !b_nwtn3rd;
+        break;
+    case CMD_TOGGLE_REPULSION:
+        b_repulsion = !b_repulsion;
+        break;
+    case CMD_TOGGLE_BARNES_HUT:
+        b_barnes_hut = !b_barnes_hut;
+        break;
+    case CMD_SPAWN_EMITTER:
+        if (!SpawnEmitter(cmd->value)) {
+            fprintf(stderr, "could not add emitter %zu\n", num_emitters);
+        }
+        break;
+    case CMD_NEXT_EMITTER:
+        memset(active->rocket, 0, sizeof(active->rocket));
+        active->thrust = 0;
+        active_emitter = (active_emitter + 1) % num_emitters;
+        break;
+    case CMD_EMITTER_SIZE:
+        if ((cmd->value.x < 0 && active->size > MIN_ESIZE)
+            || (cmd->value.x > 0 && active->size < MAX_ESIZE)) {
+            active->size += cmd->value.x;
+            active->ratio = EmitRatio(active);
+        }
+        break;
+    case CMD_REPULSION_RADIUS:
+        if ((cmd->value.x < 0 && repulsion_radius > .01)
+            || (cmd->value.x > 0 && repulsion_radius < 10)) {
+            repulsion_radius += cmd->value.x;
+        }
+        break;
+    case CMD_REPULSION_FACTOR:
+        if ((cmd->value.x < 0 && repulsion_factor > -10.)
+            || (cmd->value.x > 0 && repulsion_factor < 10.)) {
+            repulsion_factor += cmd->value.x;
+        }
+        break;
+    case CMD_OPENING_ANGLE:
+        if ((cmd->value.x < 0 && opening_angle > .01) || (cmd->value.x > 0 && opening_angle < 1.5)) {
+            opening_angle += cmd->value.x;
+        }
+        break;
+    case CMD_BROWN_FACTOR:
+        if ((cmd->value.x < 0 && brown_factor > 0.01) || (cmd->value.x > 0 && brown_factor < 2.)) {
+            brown_factor += cmd->value.x;
+        }
+        break;
+    case CMD_STOP_EMITTER:
+        active->velocity = Vector2Zero();
+        break;
+    case CMD_THRUST:
+        // held until the next one, SimStep fires the thrusters every tick
+        active->thrust = cmd->dirs;
+        break;
+    case CMD_MOVE_EMITTER:
+        active->pos = cmd->value;
+        active->velocity = Vector2Zero();
+        break;
+    case CMD_THROW_EMITTER:
+        active->velocity = cmd->value;
+        break;
+    }
+}
+
+void SimStep(const float frameTime) {
+    const float deltaTime = frameTime * TIMESCALE;
+    StepArgs step = {.integrate = {.dt = deltaTime,
+                                   .width = world_width,
+                                   .height = world_height,
+                                   .friction_scale = 1.f / (MAX_ESIZE * 2),
+                                   .gravity = b_gravity ? 5.f * deltaTime : 0,
+                                   .brown_factor = b_brownian ? brown_factor : 0,
+                                   .drag = .99995f}};
+    step.forces = IntegrateForcesKernel(&step.integrate);
+    const bool interval = ++frames % PARTICLE_INTERVAL == 0;
+    double t = ClockNow();
+    for (size_t k = 0; k < num_emitters; k++) {
+        Emitter *em = &emitters[k];
+        ApplyThrust(em);
+        // create new particle if it's time
+        const bool emitting = interval
+                              && (!b_nwtn3rd || em->rocket[0] || em->rocket[1] || em->rocket[2]
+                                  || em->rocket[3]);
+        if (emitting) {
+            emitParticle(em, emitter_seed(k), frameTime);
+        }
+        // update emitter position
+        UpdateBoxPosition(&em->pos, &em->velocity, em->size, deltaTime);
+        step.emitters[k].keyx = RngKey(emitter_seed(k), frames, RNG_BROWNIAN_X);
+        step.emitters[k].keyy = RngKey(emitter_seed(k), frames, RNG_BROWNIAN_Y);
+        step.emitters[k].emitting = emitting;
+        step.total += em->count;
+        step.blocks += update_blocks(em->count);
+    }
+    t = ProfLap(PROF_EMIT, t);
+    // update particle positions
+    if (b_repulsion && step.total > 1) {
+        DoBoxRepulsion(frameTime, step.total, step.integrate.gravity);
+        t = ProfLap(PROF_REPULSION, t);
+    }
+    PoolRun(UpdateParticlesForWorker, &step);
+    for (size_t k = 0; k < num_emitters; k++) {
+        if (step.emitters[k].emitting) {
+            DropDeadParticles(&emitters[k]);
+        }
+    }
+    ProfLap(PROF_INTEGRATE, t);
+    ProfCommit(PROF_SIM);
+}
@@ -0,0 +1,183 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "raylib.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef SCREEN_WIDTH
+#define SCREEN_WIDTH (2560)
+#endif
+#ifndef SCREEN_HEIGHT
+#define SCREEN_HEIGHT (SCREEN_WIDTH * 9 / 16)
+#endif
+
+#define SCALE (SCREEN_WIDTH / 800)
+
+#define DEFAULT_PARTICLES 4500
+
+#define NUM_BARRIERS 10
+#define MAX_BARRIERS 100000
+
+// the world is set at runtime, from MIN_WORLD_SIDE to MAX_WORLD_SIDE pixels a side; the window
+// is a view into it, and shows all of it at the default, the screen's size
+#define MIN_WORLD_SIDE 512
+#define MAX_WORLD_SIDE 65536
+
+#define PARTICLE_INTERVAL 1
+#define PARTICLE_SIZE (5.f * SCALE)
+
+#define MAX_EMITTERS 64
+
+#define EMITTER_SIZE (20.f * SCALE)
+#define MAX_ESIZE (30.f * SCALE)
+#define MIN_ESIZE (5.f * SCALE)
+
+#define TIMESCALE 10
+
+#define ALIGNED __attribute__((aligned(64)))
+
+#define min(a, b) ((a) > (b) ? (b) : (a))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define flteq(a, b) (fabs((a) - (b)) < .5)
+
+// particle pool stored as separate arrays so the hot loops only touch the fields they use
+typedef struct {
+    float *x, *y;
+    float *vx, *vy;
+    float *size;
+    float *age; // emitting steps since birth; size and colour both follow from it
+    uint8_t *still; // steps in a row it has barely moved, asleep once it reaches SLEEP_STEPS
+} Particles;
+
+// a particle that moved less than SLEEP_DISTANCE pixels a step for SLEEP_STEPS steps stops
+// being integrated until the pushes on it, net of gravity and of what walls and barriers hold
+// back, would move it that far in a step again; brownian jitter keeps everything awake
+#define SLEEP_STEPS 32
+#define SLEEP_DISTANCE .005f
+#define asleep(P, I) ((P)->still[(I)] >= SLEEP_STEPS)
+
+typedef enum { UP, DOWN, LEFT, RIGHT } Dir;
+
+// an emitter and the particles it owns
+typedef struct {
+    Vector2 pos;
+    Vector2 velocity;
+    Color color;
+    float size;
+    double ratio;        // emitter velocity -> particle velocity, see EmitRatio
+    bool rocket[4];      // thrusters held in each Dir, only the active emitter has any
+    unsigned thrust;     // 1 << Dir for each direction held, as of the last CMD_THRUST
+    Vector2 emit_offset; // where in the box the next particle appears
+    // the live particles, oldest first: particles.x[0 .. count). They are a window sliding
+    // forward through a pool of room entries per array as particles are born and die, moved
+    // back to the pool's start when it reaches the end. At most capacity are alive.
+    Particles particles;
+    size_t count, capacity, first, room;
+    // simulation scratch, one entry per particle
+    int *particle_cell;
+    void *block;
+    size_t block_bytes;
+} Emitter;
+typedef enum { AXIS_X, AXIS_Y } Axis;
+
+#define PARTICLE_COLOR RED
+
+// emitters[0 .. num_emitters), the active one is steered by input
+extern Emitter emitters[MAX_EMITTERS];
+extern size_t num_emitters, active_emitter;
+extern float world_width, world_height;
+extern Rectangle *barriers;
+extern size_t num_barriers, max_barriers;
+// bumped whenever the barriers change
+extern size_t barrier_version;
+extern bool b_gravity, b_brownian, b_nwtn3rd, b_repulsion;
+// repulsion through a Barnes-Hut quadtree: pairs as far apart as the radius reaches, with
+// groups of boxes that look smaller than opening_angle (width over distance) taken as one
+extern bool b_barnes_hut;
+extern size_t frames;
+extern uint64_t sim_seed;
+extern double repulsion_radius, repulsion_factor, brown_factor, opening_angle;
+// colour ramp particles cycle through as they age, PALETTE_STEP entries per emitting step,
+// filled by SimInit with the hues of PARTICLE_COLOR from 10 to 360 degrees
+#define PALETTE_SIZE 256
+#define PALETTE_STEP (.72f * PALETTE_SIZE / 350)
+extern Color palette[PALETTE_SIZE];
+extern float palette_start;
+#define palette_color(AGE) \
+    (palette[(unsigned) (palette_start + (AGE) * PALETTE_STEP) % PALETTE_SIZE])
+
+// input that changes the simulation, applied between steps by SimApply
+typedef enum {
+    CMD_STOP_ALL,          // zero every emitter and particle velocity
+    CMD_REGENERATE,        // new barriers and empty pools
+    CMD_TOGGLE_GRAVITY,
+    CMD_TOGGLE_BROWNIAN,
+    CMD_TOGGLE_NWTN3RD,
+    CMD_TOGGLE_REPULSION,
+    CMD_SPAWN_EMITTER,     // value: position of a new emitter, which becomes the active one
+    CMD_NEXT_EMITTER,      // make the next emitter the active one
+    CMD_EMITTER_SIZE,      // value.x: size step
+    CMD_REPULSION_RADIUS,  // value.x: radius step
+    CMD_REPULSION_FACTOR,  // value.x: factor step
+    CMD_BROWN_FACTOR,      // value.x: factor step
+    CMD_STOP_EMITTER,
+    CMD_THRUST,            // dirs: bitmask of the held (1 << Dir) directions
+    CMD_MOVE_EMITTER,      // value: new position, the emitter stops there
+    CMD_THROW_EMITTER,     // value: new velocity
+    CMD_TOGGLE_BARNES_HUT, // repulsion through a quadtree instead of the neighbour grid
+    CMD_OPENING_ANGLE,     // value.x: angle step
+} SimCommandType;
+
+typedef struct {
+    SimCommandType type;
+    unsigned dirs;
+    Vector2 value;
+} SimCommand;
+
+typedef struct {
+    size_t capacity; // particle pool size of each emitter
+    size_t emitters; // emitters to start with
+    size_t threads;  // worker pool size, 0 = one per core
+    size_t barriers; // how many barriers generateRandomBarriers tries to place
+    bool hugepages;  // back the particle pool with transparent huge pages where available
+    const char *profile_csv; // where to dump the profiler's samples on exit, NULL = nowhere
+    const char *replay;      // snapshot or recording to start from instead of a fresh world
+    float world_width, world_height; // 0 = the screen's size
+    bool capture_png; // F7 captures the window as numbered PNGs rather than one Y4M stream
+} SimConfig;
+
+// defaults, then PARTICLETEST_PARTICLES / _EMITTERS / _THREADS / _BARRIERS / _HUGEPAGES /
+// _PROFILE_CSV / _REPLAY / _WORLD / _CAPTURE_PNG, then --particles N / --emitters N /
+// --threads N / --barriers N / --hugepages / --profile-csv PATH / --replay PATH / --world WxH /
+// --capture-png on the command line
+SimConfig SimConfigFromArgs(int argc, char **argv);
+// allocate the starting emitters, start the worker pool and pick integration kernels
+bool SimInit(const SimConfig *config);
+void SimShutdown(void);
+// seed particle jitter, emission and barrier placement (counter-based, so reproducible across
+// thread counts) and raylib's generator, which the bench still scatters particles with
+void SimSeed(uint64_t seed);
+// advance the simulation by one frame of frameTime seconds
+void SimStep(float frameTime);
+void SimApply(const SimCommand *cmd);
+
+// resize the world and the grids over it; false if a side is out of range or out of memory
+bool SetWorldSize(float width, float height);
+// place up to the configured number of non-overlapping barriers and rebuild their grid
+void generateRandomBarriers(void);
+// replace the barriers with n copied from src, growing max_barriers to fit
+bool SetBarriers(const Rectangle *src, size_t n);
+// drop every emitter; the pools SpawnEmitter allocates from here on hold capacity particles
+void ClearEmitters(size_t capacity);
+// add an emitter at pos with its own pool; false if there are MAX_EMITTERS or out of memory
+bool SpawnEmitter(Vector2 pos);
+// kill every particle of the emitter
+void ResetParticles(Emitter *e);
+// make every particle move again, for changes that affect particles at rest
+void WakeParticles(void);
+// emitter velocity -> particle velocity ratio for the emitter's current size
+double EmitRatio(const Emitter *em);
+
+#endif
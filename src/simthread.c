@@ -0,0 +1,232 @@
+#include "simthread.h"
+#include "clock.h"
+#include "profile.h"
+#include "snapshot.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ticks to run back to back before giving up on catching up with the wall clock
+#define MAX_CATCHUP 25
+#define QUEUE_SIZE 256
+
+// single-producer (render thread) single-consumer (sim thread) command ring
+static SimCommand queue[QUEUE_SIZE];
+static atomic_size_t queue_head, queue_tail;
+
+// triple buffer: the sim thread fills states[back], then swaps it into latest;
+// the render thread swaps latest out into front whenever FRESH is set
+#define FRESH 4u
+static RenderState states[3];
+static unsigned back = 0, front = 1;
+static atomic_uint latest = 2;
+
+static pthread_t sim_thread;
+static atomic_bool quitting;
+// capture requests from the render thread, served between ticks
+static atomic_bool snapshot_wanted, recording_wanted;
+
+bool SimThreadSend(SimCommand cmd) {
+    const size_t head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&queue_tail, memory_order_acquire) == QUEUE_SIZE) {
+        return false;
+    }
+    queue[head % QUEUE_SIZE] = cmd;
+    atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+    return true;
+}
+
+// drain the queue; while a recording is replaying, live input is dropped instead of applied
+static void ApplyCommands(const bool replaying) {
+    size_t tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&queue_head, memory_order_acquire);
+    for (; tail != head && !replaying; tail++) {
+        const SimCommand *cmd = &queue[tail % QUEUE_SIZE];
+        RecordCommand(cmd);
+        SimApply(cmd);
+    }
+    atomic_store_explicit(&queue_tail, head, memory_order_release);
+}
+
+static void ServeCaptures(void) {
+    char path[64];
+    if (atomic_exchange(&snapshot_wanted, false)) {
+        snprintf(path, sizeof(path), "snapshot-%zu.bin", frames);
+        if (!SnapshotSave(path)) {
+            fprintf(stderr, "could not write snapshot '%s'\n", path);
+        }
+    }
+    const bool wanted = atomic_load(&recording_wanted);
+    if (wanted && !Recording()) {
+        snprintf(path, sizeof(path), "recording-%zu.bin", frames);
+        if (!RecordStart(path)) {
+            fprintf(stderr, "could not start recording '%s'\n", path);
+            atomic_store(&recording_wanted, false);
+        }
+    } else if (!wanted && Recording()) {
+        RecordStop();
+    }
+}
+
+void SimThreadSnapshot(void) {
+    atomic_store(&snapshot_wanted, true);
+}
+
+void SimThreadRecord(const bool on) {
+    atomic_store(&recording_wanted, on);
+}
+
+bool SimThreadRecording(void) {
+    return atomic_load(&recording_wanted);
+}
+
+// room for every particle the emitters can hold and for max_barriers, which a replay's
+// SetBarriers can raise; only the sim thread touches states[back]
+static bool Reserve(RenderState *rs) {
+    if (max_barriers + 1 > rs->barrier_capacity) {
+        Rectangle *grown = malloc((max_barriers + 1) * sizeof(*barriers));
+        if (!grown) {
+            return false;
+        }
+        free(rs->barriers);
+        rs->barriers = grown;
+        rs->barrier_capacity = max_barriers + 1;
+        // nothing copied into the new buffer yet
+        rs->barrier_version = (size_t) -1;
+    }
+    size_t capacity = 0;
+    for (size_t k = 0; k < num_emitters; k++) {
+        capacity += emitters[k].capacity;
+    }
+    if (capacity <= rs->capacity) {
+        return true;
+    }
+    float *block = malloc(6 * capacity * sizeof(float));
+    if (!block) {
+        return false;
+    }
+    free(rs->x);
+    rs->x = block;
+    rs->y = block + capacity;
+    rs->vx = block + 2 * capacity;
+    rs->vy = block + 3 * capacity;
+    rs->size = block + 4 * capacity;
+    rs->age = block + 5 * capacity;
+    rs->capacity = capacity;
+    return true;
+}
+
+static void Publish(void) {
+    const double start = ClockNow();
+    RenderState *rs = &states[back];
+    if (!Reserve(rs)) {
+        // keep showing the last tick that fit
+        return;
+    }
+    rs->time = ClockNow();
+    rs->frames = frames;
+    rs->num_emitters = num_emitters;
+    rs->active_emitter = active_emitter;
+    rs->count = 0;
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Emitter *em = &emitters[k];
+        const Particles *p = &em->particles;
+        const size_t n = em->count, first = rs->count;
+        rs->emitters[k] = (EmitterState){em->pos, em->velocity, em->color, em->size, first, n};
+        memcpy(rs->x + first, p->x, n * sizeof(float));
+        memcpy(rs->y + first, p->y, n * sizeof(float));
+        memcpy(rs->vx + first, p->vx, n * sizeof(float));
+        memcpy(rs->vy + first, p->vy, n * sizeof(float));
+        memcpy(rs->size + first, p->size, n * sizeof(float));
+        memcpy(rs->age + first, p->age, n * sizeof(float));
+        rs->count += n;
+    }
+    // barriers only change on CMD_REGENERATE, so each buffer copies them once per change
+    if (rs->barrier_version != barrier_version) {
+        memcpy(rs->barriers, barriers, num_barriers * sizeof(*barriers));
+        rs->num_barriers = num_barriers;
+        rs->barrier_version = barrier_version;
+    }
+    rs->world_width = world_width;
+    rs->world_height = world_height;
+    rs->gravity = b_gravity;
+    rs->brownian = b_brownian;
+    rs->nwtn3rd = b_nwtn3rd;
+    rs->repulsion = b_repulsion;
+    rs->barnes_hut = b_barnes_hut;
+    rs->repulsion_radius = repulsion_radius;
+    rs->repulsion_factor = repulsion_factor;
+    rs->brown_factor = brown_factor;
+    rs->opening_angle = opening_angle;
+    back = atomic_exchange_explicit(&latest, back | FRESH, memory_order_acq_rel) & ~FRESH;
+    // lands in the sample of the next tick
+    ProfLap(PROF_PUBLISH, start);
+}
+
+const RenderState *SimThreadAcquire(void) {
+    if (atomic_load_explicit(&latest, memory_order_relaxed) & FRESH) {
+        front = atomic_exchange_explicit(&latest, front, memory_order_acq_rel) & ~FRESH;
+    }
+    return &states[front];
+}
+
+static void *SimThreadMain(void *arg) {
+    (void) arg;
+    double next_tick = ClockNow();
+    while (!atomic_load(&quitting)) {
+        size_t steps = 0;
+        while (ClockNow() >= next_tick && steps < MAX_CATCHUP) {
+            ServeCaptures();
+            ApplyCommands(ReplayTick());
+            SimStep(SIM_DT);
+            next_tick += SIM_DT;
+            steps++;
+        }
+        if (steps == MAX_CATCHUP) {
+            // too far behind, drop the backlog instead of spiralling
+            next_tick = ClockNow();
+        }
+        if (steps > 0) {
+            Publish();
+        }
+        ClockSleepUntil(next_tick);
+    }
+    return 0;
+}
+
+static void FreeStates(void) {
+    for (int i = 0; i < 3; i++) {
+        free(states[i].x);
+        free(states[i].barriers);
+        memset(&states[i], 0, sizeof(states[i]));
+    }
+}
+
+bool SimThreadStart(void) {
+    for (int i = 0; i < 3; i++) {
+        if (!Reserve(&states[i])) {
+            FreeStates();
+            return false;
+        }
+    }
+    // hand the render thread a filled front buffer; every later one is published before it
+    // can reach the front
+    Publish();
+    SimThreadAcquire();
+    atomic_store(&quitting, false);
+    if (pthread_create(&sim_thread, NULL, SimThreadMain, NULL) != 0) {
+        FreeStates();
+        return false;
+    }
+    return true;
+}
+
+void SimThreadStop(void) {
+    atomic_store(&quitting, true);
+    pthread_join(sim_thread, NULL);
+    RecordStop();
+    ReplayStop();
+    FreeStates();
+}
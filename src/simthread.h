@@ -0,0 +1,52 @@
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include "sim.h"
+
+// barrier collisions are swept, so coarser steps stay inside the barriers; recordings only
+// replay at the rate they were made at
+#ifndef SIM_HZ
+#define SIM_HZ 500
+#endif
+#define SIM_DT (1.f / SIM_HZ)
+
+// one emitter as drawn: its particles are [first, first + count) of the RenderState arrays,
+// oldest first
+typedef struct {
+    Vector2 pos, velocity;
+    Color color;
+    float size;
+    size_t first, count;
+} EmitterState;
+
+// everything Draw and the HUD need from one simulation tick
+typedef struct {
+    double time; // ClockNow() when published
+    size_t frames;
+    EmitterState emitters[MAX_EMITTERS];
+    size_t num_emitters, active_emitter;
+    size_t count, capacity; // particles of all emitters back to back, and room in the arrays
+    float *x, *y, *vx, *vy, *size, *age;
+    Rectangle *barriers;
+    size_t num_barriers, barrier_version, barrier_capacity;
+    float world_width, world_height;
+    bool gravity, brownian, nwtn3rd, repulsion, barnes_hut;
+    double repulsion_radius, repulsion_factor, brown_factor, opening_angle;
+} RenderState;
+
+// run SimStep at a fixed SIM_HZ on its own thread; call after SimInit
+bool SimThreadStart(void);
+void SimThreadStop(void);
+// queue a command for the simulation thread; false if the queue is full and it was dropped
+bool SimThreadSend(SimCommand cmd);
+// newest published tick; stays valid and unchanged until the next call
+const RenderState *SimThreadAcquire(void);
+// before the next tick, write the state to snapshot-<frame>.bin
+void SimThreadSnapshot(void);
+// start or stop recording the state and every command from the next tick on, into
+// recording-<frame>.bin
+void SimThreadRecord(bool on);
+// whether a recording is on, or about to be; turns itself off if the file can't be written
+bool SimThreadRecording(void);
+
+#endif
@@ -0,0 +1,442 @@
+#include "snapshot.h"
+#include "simthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_MAGIC "PTSNAP"
+#define SNAPSHOT_VERSION 7
+// pools start on this boundary so they map on any page size up to it
+#define SNAPSHOT_ALIGN 65536
+
+#define align_up(N) (((N) + SNAPSHOT_ALIGN - 1) & ~(uint64_t) (SNAPSHOT_ALIGN - 1))
+
+enum {
+    SNAP_GRAVITY = 1,
+    SNAP_BROWNIAN = 2,
+    SNAP_NWTN3RD = 4,
+    SNAP_REPULSION = 8,
+    SNAP_BARNES_HUT = 16
+};
+
+// file layout: header, emitter table, barriers, then each pool and finally the command log,
+// all of those on SNAPSHOT_ALIGN boundaries
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_bytes; // sizeof(CommandRecord), catches layout changes the version missed
+    uint32_t screen_width, screen_height;
+    uint32_t sim_hz; // step rate of the build that wrote it
+    float world_width, world_height;
+    uint32_t num_emitters, active_emitter;
+    uint32_t flags;
+    uint64_t capacity, num_barriers;
+    uint64_t seed, frames;
+    double repulsion_radius, repulsion_factor, brown_factor, opening_angle;
+    uint64_t commands_offset;
+} SnapshotHeader;
+
+typedef struct {
+    Vector2 pos, velocity, emit_offset;
+    Color color;
+    float size;
+    double ratio;
+    uint8_t rocket[4];
+    uint32_t thrust;
+    uint64_t count;
+    // the particle arrays of the pool block, without the scratch behind them; the live
+    // particles are saved at the start of each array
+    uint64_t pool_offset, pool_bytes;
+} SnapshotEmitter;
+
+typedef struct {
+    uint64_t frame;
+    SimCommand cmd;
+} CommandRecord;
+
+static FILE *record_file;
+// commands appended to it since RecordStart, and those from the first failed fwrite on: a
+// recording with a gap would replay wrong, so nothing is written past it
+static size_t record_written, record_failed;
+
+// the recording being replayed; commands point into the mapping
+static struct {
+    const unsigned char *data;
+    size_t bytes;
+    const CommandRecord *commands;
+    size_t num_commands, next_command;
+} replay;
+
+// x, y, vx, vy, size, age and still; the block's scratch starts at particle_cell
+#define pool_bytes(E) ((uint64_t) ((char *) (E)->particle_cell - (char *) (E)->block))
+
+static bool WriteBytes(FILE *f, uint64_t *offset, const void *data, const uint64_t bytes) {
+    *offset += bytes;
+    return fwrite(data, 1, bytes, f) == bytes;
+}
+
+static bool PadTo(FILE *f, uint64_t *offset, const uint64_t target) {
+    static const char zeros[4096];
+    while (*offset < target) {
+        if (!WriteBytes(f, offset, zeros, min(target - *offset, sizeof(zeros)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool WriteSnapshot(FILE *f) {
+    SnapshotHeader header = {.magic = SNAPSHOT_MAGIC,
+                             .version = SNAPSHOT_VERSION,
+                             .record_bytes = sizeof(CommandRecord),
+                             .screen_width = SCREEN_WIDTH,
+                             .screen_height = SCREEN_HEIGHT,
+                             .sim_hz = SIM_HZ,
+                             .world_width = world_width,
+                             .world_height = world_height,
+                             .num_emitters = num_emitters,
+                             .active_emitter = active_emitter,
+                             .flags = (b_gravity ? SNAP_GRAVITY : 0)
+                                      | (b_brownian ? SNAP_BROWNIAN : 0)
+                                      | (b_nwtn3rd ? SNAP_NWTN3RD : 0)
+                                      | (b_repulsion ? SNAP_REPULSION : 0)
+                                      | (b_barnes_hut ? SNAP_BARNES_HUT : 0),
+                             .capacity = emitters[0].capacity,
+                             .num_barriers = num_barriers,
+                             .seed = sim_seed,
+                             .frames = frames,
+                             .repulsion_radius = repulsion_radius,
+                             .repulsion_factor = repulsion_factor,
+                             .brown_factor = brown_factor,
+                             .opening_angle = opening_angle};
+    SnapshotEmitter table[MAX_EMITTERS];
+    uint64_t offset = align_up(sizeof(header) + num_emitters * sizeof(*table)
+                               + num_barriers * sizeof(*barriers));
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Emitter *em = &emitters[k];
+        table[k] = (SnapshotEmitter){em->pos,
+                                     em->velocity,
+                                     em->emit_offset,
+                                     em->color,
+                                     em->size,
+                                     em->ratio,
+                                     {em->rocket[UP],
+                                      em->rocket[DOWN],
+                                      em->rocket[LEFT],
+                                      em->rocket[RIGHT]},
+                                     em->thrust,
+                                     em->count,
+                                     offset,
+                                     pool_bytes(em)};
+        offset = align_up(offset + table[k].pool_bytes);
+    }
+    header.commands_offset = offset;
+
+    offset = 0;
+    if (!WriteBytes(f, &offset, &header, sizeof(header))
+        || !WriteBytes(f, &offset, table, num_emitters * sizeof(*table))
+        || !WriteBytes(f, &offset, barriers, num_barriers * sizeof(*barriers))) {
+        return false;
+    }
+    for (size_t k = 0; k < num_emitters; k++) {
+        const Emitter *em = &emitters[k];
+        const float *arrays[6] = {em->particles.x,
+                                  em->particles.y,
+                                  em->particles.vx,
+                                  em->particles.vy,
+                                  em->particles.size,
+                                  em->particles.age};
+        for (int a = 0; a < 6; a++) {
+            if (!PadTo(f, &offset, table[k].pool_offset + a * em->room * sizeof(float))
+                || !WriteBytes(f, &offset, arrays[a], em->count * sizeof(float))) {
+                return false;
+            }
+        }
+        // sleeping particles stay asleep in a replay
+        if (!PadTo(f, &offset, table[k].pool_offset + 6 * em->room * sizeof(float))
+            || !WriteBytes(f, &offset, em->particles.still, em->count)) {
+            return false;
+        }
+    }
+    // the padding also keeps the bytes past a pool's last page zero once it is mapped
+    return PadTo(f, &offset, header.commands_offset);
+}
+
+// a new file at path holding a snapshot of now and nothing else yet, NULL if it can't be written
+static FILE *CreateSnapshot(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return NULL;
+    }
+    if (!WriteSnapshot(f) || fflush(f) != 0) {
+        fclose(f);
+        remove(path);
+        return NULL;
+    }
+    return f;
+}
+
+bool RecordStart(const char *path) {
+    RecordStop();
+    FILE *f = CreateSnapshot(path);
+    if (!f) {
+        return false;
+    }
+    record_file = f;
+    record_written = record_failed = 0;
+    return true;
+}
+
+void RecordCommand(const SimCommand *cmd) {
+    if (record_file) {
+        const CommandRecord record = {frames, *cmd};
+        if (record_failed == 0 && fwrite(&record, sizeof(record), 1, record_file) == 1) {
+            record_written++;
+        } else {
+            record_failed++;
+        }
+    }
+}
+
+void RecordStop(void) {
+    if (record_file) {
+        // what is still buffered only reaches the file here
+        const bool closed = fclose(record_file) == 0;
+        record_file = NULL;
+        if (record_failed) {
+            fprintf(stderr,
+                    "recording: a write failed, at least the last %zu of %zu commands are "
+                    "missing\n",
+                    record_failed,
+                    record_written + record_failed);
+        } else if (!closed) {
+            fprintf(stderr, "recording: the last commands could not be written\n");
+        }
+    }
+}
+
+bool Recording(void) {
+    return record_file != NULL;
+}
+
+bool SnapshotSave(const char *path) {
+    FILE *f = CreateSnapshot(path);
+    if (!f) {
+        return false;
+    }
+    if (fclose(f) != 0) {
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+// no mmap: read the whole file, pools get copied out of it
+static bool MapFile(const char *path, int *fd) {
+    *fd = -1;
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    unsigned char *data = NULL;
+    long bytes = -1;
+    if (fseek(f, 0, SEEK_END) == 0 && (bytes = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0
+        && (data = malloc(bytes)) && fread(data, 1, bytes, f) != (size_t) bytes) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    replay.data = data;
+    replay.bytes = data ? (size_t) bytes : 0;
+    return data != NULL;
+}
+
+static void UnmapFile(void) {
+    free((void *) replay.data);
+}
+
+static void MapPool(const int fd, const uint64_t offset, void *dest, const size_t bytes) {
+    (void) fd;
+    memcpy(dest, replay.data + offset, bytes);
+}
+#else
+static bool MapFile(const char *path, int *fd) {
+    struct stat st;
+    if ((*fd = open(path, O_RDONLY)) < 0) {
+        return false;
+    }
+    void *data = MAP_FAILED;
+    if (fstat(*fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, *fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        close(*fd);
+        return false;
+    }
+    replay.data = data;
+    replay.bytes = st.st_size;
+    return true;
+}
+
+static void UnmapFile(void) {
+    munmap((void *) replay.data, replay.bytes);
+}
+
+// the pages over the emitter's block become a private copy-on-write view of the file, only
+// read in as the simulation touches them
+static void MapPool(const int fd, const uint64_t offset, void *dest, const size_t bytes) {
+    if (mmap(dest, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset)
+        == MAP_FAILED) {
+        // pages bigger than SNAPSHOT_ALIGN
+        memcpy(dest, replay.data + offset, bytes);
+    }
+}
+#endif
+
+static bool ValidSnapshot(const SnapshotHeader *h) {
+    if (replay.bytes < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))
+        || h->version != SNAPSHOT_VERSION || h->record_bytes != sizeof(CommandRecord)) {
+        fprintf(stderr, "not a snapshot, or from another version\n");
+        return false;
+    }
+    if (h->screen_width != SCREEN_WIDTH || h->screen_height != SCREEN_HEIGHT) {
+        fprintf(stderr,
+                "snapshot is for a %ux%u screen, this build is %dx%d\n",
+                h->screen_width,
+                h->screen_height,
+                SCREEN_WIDTH,
+                SCREEN_HEIGHT);
+        return false;
+    }
+    if (h->sim_hz != SIM_HZ) {
+        fprintf(stderr,
+                "snapshot was taken at %u Hz, this build steps at %d Hz\n",
+                h->sim_hz,
+                SIM_HZ);
+        return false;
+    }
+    if (h->num_emitters < 1 || h->num_emitters > MAX_EMITTERS
+        || h->active_emitter >= h->num_emitters || h->capacity < 2
+        || h->num_barriers > MAX_BARRIERS || h->commands_offset > replay.bytes) {
+        fprintf(stderr, "snapshot header is corrupt\n");
+        return false;
+    }
+    const SnapshotEmitter *table = (const SnapshotEmitter *) (h + 1);
+    if (sizeof(*h) + h->num_emitters * sizeof(*table) + h->num_barriers * sizeof(Rectangle)
+        > h->commands_offset) {
+        fprintf(stderr, "snapshot header is corrupt\n");
+        return false;
+    }
+    for (size_t k = 0; k < h->num_emitters; k++) {
+        if (table[k].count > h->capacity || table[k].pool_offset % SNAPSHOT_ALIGN != 0
+            || table[k].pool_offset + table[k].pool_bytes > h->commands_offset) {
+            fprintf(stderr, "snapshot emitter %zu is corrupt\n", k);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReplayStart(const char *path) {
+    ReplayStop();
+    int fd;
+    if (!MapFile(path, &fd)) {
+        fprintf(stderr, "could not open snapshot '%s'\n", path);
+        return false;
+    }
+    const SnapshotHeader *h = (const SnapshotHeader *) replay.data;
+    if (!ValidSnapshot(h)) {
+        ReplayStop();
+#ifndef _WIN32
+        close(fd);
+#endif
+        return false;
+    }
+    const SnapshotEmitter *table = (const SnapshotEmitter *) (h + 1);
+    const Rectangle *saved_barriers = (const Rectangle *) (table + h->num_emitters);
+
+    // the barrier grid is sized to the world, so the world comes first
+    bool ok = SetWorldSize(h->world_width, h->world_height)
+              && SetBarriers(saved_barriers, h->num_barriers);
+    ClearEmitters(h->capacity);
+    for (size_t k = 0; ok && k < h->num_emitters; k++) {
+        const SnapshotEmitter *se = &table[k];
+        if (!(ok = SpawnEmitter(se->pos) && pool_bytes(&emitters[k]) == se->pool_bytes)) {
+            fprintf(stderr, "could not restore emitter %zu\n", k);
+            break;
+        }
+        Emitter *em = &emitters[k];
+        MapPool(fd, se->pool_offset, em->block, se->pool_bytes);
+        em->velocity = se->velocity;
+        em->emit_offset = se->emit_offset;
+        em->color = se->color;
+        em->size = se->size;
+        em->ratio = se->ratio;
+        for (int d = UP; d <= RIGHT; d++) {
+            em->rocket[d] = se->rocket[d];
+        }
+        em->thrust = se->thrust;
+        // the emitter's window is at the start of its fresh pool, where the particles were saved
+        em->count = se->count;
+    }
+#ifndef _WIN32
+    // the pool mappings hold their own reference to the file
+    close(fd);
+#endif
+    if (!ok) {
+        ReplayStop();
+        return false;
+    }
+    active_emitter = h->active_emitter;
+    SimSeed(h->seed);
+    frames = h->frames;
+    b_gravity = h->flags & SNAP_GRAVITY;
+    b_brownian = h->flags & SNAP_BROWNIAN;
+    b_nwtn3rd = h->flags & SNAP_NWTN3RD;
+    b_repulsion = h->flags & SNAP_REPULSION;
+    b_barnes_hut = h->flags & SNAP_BARNES_HUT;
+    repulsion_radius = h->repulsion_radius;
+    repulsion_factor = h->repulsion_factor;
+    brown_factor = h->brown_factor;
+    opening_angle = h->opening_angle;
+
+    replay.commands = (const CommandRecord *) (replay.data + h->commands_offset);
+    replay.num_commands = (replay.bytes - h->commands_offset) / sizeof(CommandRecord);
+    replay.next_command = 0;
+    if (replay.num_commands == 0) {
+        // a plain snapshot, nothing left to hold on to
+        ReplayStop();
+    }
+    return true;
+}
+
+bool ReplayTick(void) {
+    if (!replay.data) {
+        return false;
+    }
+    while (replay.next_command < replay.num_commands
+           && replay.commands[replay.next_command].frame <= frames) {
+        const SimCommand *cmd = &replay.commands[replay.next_command++].cmd;
+        RecordCommand(cmd);
+        SimApply(cmd);
+    }
+    if (replay.next_command == replay.num_commands) {
+        ReplayStop();
+        return false;
+    }
+    return true;
+}
+
+void ReplayStop(void) {
+    if (replay.data) {
+        UnmapFile();
+    }
+    memset(&replay, 0, sizeof(replay));
+}
@@ -0,0 +1,28 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "sim.h"
+
+// A snapshot is the whole simulation between two steps: every emitter and its particle pool,
+// the barriers, toggles and factors, the seed and the frame counter. A recording is a snapshot
+// followed by the commands applied from then on, each tagged with the frame it went in at, so
+// replaying it reproduces the run step for step. Pools sit page-aligned in the file and are
+// mapped copy-on-write straight into the emitters.
+
+// write the current state to path; a recording in progress carries on
+bool SnapshotSave(const char *path);
+// write the current state to path and keep appending the commands RecordCommand gets
+bool RecordStart(const char *path);
+// log a command about to be applied before the next step; does nothing unless recording
+void RecordCommand(const SimCommand *cmd);
+void RecordStop(void);
+bool Recording(void);
+
+// replace the simulation with the snapshot or recording at path; call after SimInit, on the
+// thread that steps the simulation
+bool ReplayStart(const char *path);
+// apply the recorded commands due before the next SimStep; false once there are none left
+bool ReplayTick(void);
+void ReplayStop(void);
+
+#endif